@@ -252,10 +252,8 @@ static int fltk_cmd_handler(pinentry_t pe)
 				else
 					ret = 1;
 
-				pinentry_setbufferlen(pe, password.size()+1);
-				if (pe->pin)
+				if (pinentry_setbuffer_copy(pe, password.c_str(), password.size()))
 				{
-					memcpy(pe->pin, password.c_str(), password.size()+1);
 					pe->result = password.size();
 					ret = password.size();
 				}
@@ -43,6 +43,15 @@
 
 #define PGMNAME "pinentry-gnome3"
 
+/* The number of seconds the availability of the session bus and the
+   system prompter is reused by further pinentries of the same D-Bus
+   session.  */
+#define PROBE_CACHE_TTL 5
+
+/* The number of seconds without a command after which the prompt
+   kept open for the session is closed.  */
+#define PROMPT_IDLE_TIMEOUT 5
+
 #ifndef VERSION
 #  define VERSION
 #endif
@@ -64,6 +73,16 @@ static void pe_gcr_prompt_confirm_done (GObject *source_object,
                                         GAsyncResult *res, gpointer user_data);
 static gboolean pe_gcr_timeout_done (gpointer user_data);
 
+/* The system prompt of the session.  It is kept open after a command
+   has been answered, so that further commands, e.g. a retry after a
+   bad passphrase, reuse it instead of opening a new one.  It is
+   closed at the end of the session, after PROMPT_IDLE_TIMEOUT seconds
+   without a command, and when a command was canceled or failed.  */
+static GcrPrompt *session_prompt;
+
+/* The timeout SESSION_PROMPT was opened with.  */
+static int session_prompt_timeout;
+
 
 
 static gchar *
@@ -119,6 +138,28 @@ _propagate_g_error_to_pinentry (pinentry_t pe, GError *error,
   pe->specific_err_loc = loc;
 }
 
+static void
+close_session_prompt (void)
+{
+  GError *error = NULL;
+
+  if (!session_prompt)
+    return;
+
+  if (!gcr_system_prompt_close (GCR_SYSTEM_PROMPT (session_prompt),
+                                NULL, &error))
+    {
+      fprintf (stderr, "failed to close Gcr System Prompt (%d): %s\n",
+               error ? error->code : -1,
+               error ? error->message : "<no GError>");
+      if (error)
+        g_error_free (error);
+    }
+  g_clear_object (&session_prompt);
+}
+
+/* Return the system prompt of the session, set up for PE.  The prompt
+   is owned by the session and must not be unreferenced.  */
 static GcrPrompt *
 create_prompt (pinentry_t pe, int confirm)
 {
@@ -127,8 +168,21 @@ create_prompt (pinentry_t pe, int confirm)
   char *msg, *p;
   char window_id[32];
 
-  /* Create the prompt.  */
-  prompt = GCR_PROMPT (gcr_system_prompt_open (pe->timeout ? pe->timeout : -1, NULL, &error));
+  /* Reuse the prompt of the last command, or create a new one.  The
+     timeout of a system prompt is fixed when it is opened, thus a
+     prompt opened with a different timeout can't be reused.  */
+  if (session_prompt && session_prompt_timeout != pe->timeout)
+    close_session_prompt ();
+  if (session_prompt)
+    {
+      prompt = session_prompt;
+      gcr_prompt_reset (prompt);
+    }
+  else
+    {
+      prompt = GCR_PROMPT (gcr_system_prompt_open (pe->timeout ? pe->timeout : -1, NULL, &error));
+      session_prompt_timeout = pe->timeout;
+    }
   if (! prompt)
     {
       /* this means the timeout elapsed, but no prompt was ever shown. */
@@ -233,6 +287,7 @@ create_prompt (pinentry_t pe, int confirm)
     }
 #endif
 
+  session_prompt = prompt;
   return prompt;
 }
 
@@ -277,7 +332,12 @@ gnome3_cmd_handler (pinentry_t pe)
     g_source_destroy
       (g_main_context_find_source_by_id (NULL, state.timeout_id));
 
-  g_clear_object (&state.prompt);
+  /* Keep the prompt only if the user answered it; a canceled, failed
+     or timed out prompt must go away.  */
+  if (state.timed_out)
+    g_clear_object (&session_prompt);  /* Already closed.  */
+  else if (state.ret <= 0)
+    close_session_prompt ();
   g_main_loop_unref (state.main_loop);
   return state.ret;
 };
@@ -320,9 +380,7 @@ pe_gcr_prompt_password_done (GObject *source_object,
 	}
       else
 	{
-	  pinentry_setbufferlen (pe, strlen (password) + 1);
-	  if (pe->pin)
-	    strcpy (pe->pin, password);
+	  pinentry_setbuffer_copy (pe, password, strlen (password));
 
 	  if (pe->repeat_passphrase)
 	    pe->repeat_okay = 1;
@@ -410,47 +468,120 @@ pe_gcr_timeout_done (gpointer user_data)
 
 pinentry_cmd_handler_t pinentry_cmd_handler = gnome3_cmd_handler;
 
-/* Test whether there is a GNOME screensaver running that happens to
- * be locked.  Note that if there is no GNOME screensaver running at
- * all the answer is still FALSE.  */
-static gboolean
-pe_gnome_screen_locked (void)
+/* The results of the startup probes.  */
+struct pe_gnome3_probe_s {
+  GMainLoop *main_loop;
+  /* Number of probes still running.  */
+  int pending;
+  /* Whether we can create a system prompt.  */
+  int prompt_available;
+  /* Whether we could connect to the session bus.  */
+  int bus_available;
+  /* Whether a GNOME screensaver is running and locked.  */
+  gboolean screen_locked;
+};
+
+/* The session bus, shared by all D-Bus calls of the process.  */
+static GDBusConnection *session_bus;
+
+
+/* Return the name of the file caching the availability, or NULL if
+ * we can't tell the session apart.  The caller must g_free the
+ * result.  */
+static gchar *
+pe_probe_cache_file (void)
 {
-  GDBusConnection *dbus;
-  GError *error = NULL;
-  GVariant *reply, *reply_bool;
-  gboolean ret;
+  const char *runtime_dir = g_get_user_runtime_dir ();
+
+  if (!runtime_dir || !*runtime_dir)
+    return NULL;
+  return g_build_filename (runtime_dir, "pinentry-gnome3-avail", NULL);
+}
 
-  dbus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+/* Fill in the availability in PROBE from the cache if it was stored
+ * for the current D-Bus session less than PROBE_CACHE_TTL seconds
+ * ago.  The lock state of the screen is not cached because it may
+ * change at any time.  Returns true on success.  */
+static int
+pe_probe_cache_load (struct pe_gnome3_probe_s *probe)
+{
+  const char *address = getenv ("DBUS_SESSION_BUS_ADDRESS");
+  gchar *fname;
+  gchar *contents = NULL;
+  gint64 stamp, now;
+  int prompt_available, bus_available, n;
+  int ret = 0;
 
-  if (!dbus)
+  fname = pe_probe_cache_file ();
+  if (!fname || !address)
     {
-      fprintf (stderr, "failed to connect to user session D-Bus (%d): %s",
-               error ? error->code : -1,
-               error ? error->message : "<no GError>");
-      if (error)
-        g_error_free (error);
-      return FALSE;
+      g_free (fname);
+      return 0;
     }
 
-  /* this is intended to be the equivalent of:
-   * dbus-send --print-reply=literal --session          \
-   *           --dest=org.gnome.ScreenSaver             \
-   *           /org/gnome/ScreenSaver                   \
-   *           org.gnome.ScreenSaver.GetActive
-   */
-  reply = g_dbus_connection_call_sync (dbus,
-                                       "org.gnome.ScreenSaver",
-                                       "/org/gnome/ScreenSaver",
-                                       "org.gnome.ScreenSaver",
-                                       "GetActive",
-                                       NULL,
-                                       ((const GVariantType *) "(b)"),
-                                       G_DBUS_CALL_FLAGS_NO_AUTO_START,
-                                       -1,
-                                       NULL,
-                                       &error);
-  g_object_unref(dbus);
+  if (g_file_get_contents (fname, &contents, NULL, NULL)
+      && sscanf (contents, "%" G_GINT64_FORMAT " %d %d %n",
+                 &stamp, &prompt_available, &bus_available, &n) == 3
+      && !strcmp (contents + n, address))
+    {
+      now = g_get_real_time () / G_USEC_PER_SEC;
+      if (stamp <= now && now - stamp < PROBE_CACHE_TTL)
+        {
+          probe->prompt_available = prompt_available;
+          probe->bus_available = bus_available;
+          ret = 1;
+        }
+    }
+
+  g_free (contents);
+  g_free (fname);
+  return ret;
+}
+
+/* Store the availability in PROBE for the current D-Bus session.
+ * Errors are ignored; the next pinentry will just run the probes
+ * again.  */
+static void
+pe_probe_cache_save (struct pe_gnome3_probe_s *probe)
+{
+  const char *address = getenv ("DBUS_SESSION_BUS_ADDRESS");
+  gchar *fname;
+  gchar *contents;
+
+  fname = pe_probe_cache_file ();
+  if (!fname || !address)
+    {
+      g_free (fname);
+      return;
+    }
+
+  contents = g_strdup_printf ("%" G_GINT64_FORMAT " %d %d %s",
+                              g_get_real_time () / G_USEC_PER_SEC,
+                              probe->prompt_available,
+                              probe->bus_available, address);
+  g_file_set_contents (fname, contents, -1, NULL);
+  g_free (contents);
+  g_free (fname);
+}
+
+
+static void
+pe_probe_done (struct pe_gnome3_probe_s *probe)
+{
+  if (!--probe->pending)
+    g_main_loop_quit (probe->main_loop);
+}
+
+static void
+pe_gnome_screen_locked_done (GObject *source_object, GAsyncResult *res,
+                             gpointer user_data)
+{
+  struct pe_gnome3_probe_s *probe = user_data;
+  GError *error = NULL;
+  GVariant *reply, *reply_bool;
+
+  reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                         res, &error);
   if (!reply)
     {
       /* G_IO_ERROR_IS_DIRECTORY is the expected response when there is
@@ -461,61 +592,163 @@ pe_gnome_screen_locked (void)
                  error ? error->message : "<no GError>");
       if (error)
         g_error_free (error);
-      return FALSE;
+      pe_probe_done (probe);
+      return;
     }
   reply_bool = g_variant_get_child_value (reply, 0);
   if (!reply_bool)
     {
       fprintf (stderr, "Failed to get d-bus boolean from org.gnome.ScreenSaver.GetActive; assuming screensaver is not locked\n");
-      ret = FALSE;
     }
   else
     {
-      ret = g_variant_get_boolean (reply_bool);
+      probe->screen_locked = g_variant_get_boolean (reply_bool);
       g_variant_unref (reply_bool);
     }
 
   g_variant_unref (reply);
-  return ret;
+  pe_probe_done (probe);
+}
+
+/* Test whether there is a GNOME screensaver running that happens to
+ * be locked.  Note that if there is no GNOME screensaver running at
+ * all the answer is still FALSE.  This is called once the session
+ * bus is available.  */
+static void
+pe_gnome_session_bus_ready (GObject *source_object, GAsyncResult *res,
+                            gpointer user_data)
+{
+  struct pe_gnome3_probe_s *probe = user_data;
+  GError *error = NULL;
+
+  (void)source_object;
+
+  session_bus = g_bus_get_finish (res, &error);
+  if (!session_bus)
+    {
+      fprintf (stderr, "failed to connect to user session D-Bus (%d): %s",
+               error ? error->code : -1,
+               error ? error->message : "<no GError>");
+      if (error)
+        g_error_free (error);
+      pe_probe_done (probe);
+      return;
+    }
+  probe->bus_available = 1;
+
+  /* this is intended to be the equivalent of:
+   * dbus-send --print-reply=literal --session          \
+   *           --dest=org.gnome.ScreenSaver             \
+   *           /org/gnome/ScreenSaver                   \
+   *           org.gnome.ScreenSaver.GetActive
+   */
+  g_dbus_connection_call (session_bus,
+                          "org.gnome.ScreenSaver",
+                          "/org/gnome/ScreenSaver",
+                          "org.gnome.ScreenSaver",
+                          "GetActive",
+                          NULL,
+                          ((const GVariantType *) "(b)"),
+                          G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                          -1,
+                          NULL,
+                          pe_gnome_screen_locked_done,
+                          probe);
+}
+
+static void
+pe_gcr_system_prompt_closed (GObject *source_object, GAsyncResult *res,
+                             gpointer user_data)
+{
+  struct pe_gnome3_probe_s *probe = user_data;
+  GcrSystemPrompt *prompt = GCR_SYSTEM_PROMPT (source_object);
+  GError *error = NULL;
+
+  if (!gcr_system_prompt_close_finish (prompt, res, &error))
+    fprintf (stderr, "failed to close test Gcr System Prompt (%d): %s\n",
+             error ? error->code : -1,
+             error ? error->message : "<no GError>");
+  if (error)
+    g_error_free (error);
+  g_object_unref (prompt);
+  pe_probe_done (probe);
 }
 
 /* Test whether we can create a system prompt or not.  This briefly
  * does create a system prompt, which blocks other tools from making
  * the same request concurrently, so we just create it to test if it is
  * available, and quickly close it.  */
-static int
-pe_gcr_system_prompt_available (void)
+static void
+pe_gcr_system_prompt_opened (GObject *source_object, GAsyncResult *res,
+                             gpointer user_data)
 {
-  GcrSystemPrompt *prompt;
+  struct pe_gnome3_probe_s *probe = user_data;
+  GcrPrompt *prompt;
   GError *error = NULL;
-  int ret = 0;
 
-  prompt = GCR_SYSTEM_PROMPT (gcr_system_prompt_open (0, NULL, &error));
+  (void)source_object;
+
+  prompt = gcr_system_prompt_open_finish (res, &error);
   if (prompt)
     {
-      ret = 1;
-      if (!gcr_system_prompt_close (prompt, NULL, &error))
-          fprintf (stderr, "failed to close test Gcr System Prompt (%d): %s\n",
-                   error ? error->code : -1,
-                   error ? error->message : "<no GError>");
-      g_clear_object (&prompt);
+      probe->prompt_available = 1;
+      gcr_system_prompt_close_async (GCR_SYSTEM_PROMPT (prompt), NULL,
+                                     pe_gcr_system_prompt_closed, probe);
+      return;
     }
   else if (error && error->code == GCR_SYSTEM_PROMPT_IN_PROGRESS)
     {
       /* This one particular failure is OK; we're clearly capable of
        * making a system prompt, even though someone else has the
        * system prompter right now: */
-      ret = 1;
+      probe->prompt_available = 1;
     }
 
   if (error)
     g_error_free (error);
-  return ret;
+  pe_probe_done (probe);
+}
+
+/* Find out whether a system prompt is available and whether the
+ * screen is locked.  Both probes run concurrently.  The availability
+ * of the bus and the prompter is cached for PROBE_CACHE_TTL seconds
+ * so that a burst of pinentries needs to test it only once; the
+ * screen is asked every time.  */
+static void
+pe_gnome3_probe (struct pe_gnome3_probe_s *probe)
+{
+  int cached;
+
+  memset (probe, 0, sizeof *probe);
+
+  cached = pe_probe_cache_load (probe);
+  if (cached && !probe->bus_available)
+    return;
+
+  probe->main_loop = g_main_loop_new (NULL, FALSE);
+  probe->pending = 1;
+  g_bus_get (G_BUS_TYPE_SESSION, NULL, pe_gnome_session_bus_ready, probe);
+  if (!cached)
+    {
+      probe->pending++;
+      gcr_system_prompt_open_async (0, NULL, pe_gcr_system_prompt_opened,
+                                    probe);
+    }
+  g_main_loop_run (probe->main_loop);
+  g_main_loop_unref (probe->main_loop);
+  probe->main_loop = NULL;
+
+  if (!cached)
+    pe_probe_cache_save (probe);
 }
 
 int
 main (int argc, char *argv[])
 {
+#ifdef FALLBACK_CURSES
+  struct pe_gnome3_probe_s probe;
+#endif
+
   pinentry_init (PGMNAME);
 
 #ifdef FALLBACK_CURSES
@@ -526,26 +759,34 @@ main (int argc, char *argv[])
       pinentry_cmd_handler = curses_cmd_handler;
       pinentry_set_flavor_flag ("curses");
     }
-  else if (!pe_gcr_system_prompt_available ())
-    {
-      fprintf (stderr, "No Gcr System Prompter available,"
-               " falling back to curses\n");
-      pinentry_cmd_handler = curses_cmd_handler;
-      pinentry_set_flavor_flag ("curses");
-    }
-  else if (pe_gnome_screen_locked ())
+  else
     {
-      fprintf (stderr, "GNOME screensaver is locked,"
-               " falling back to curses\n");
-      pinentry_cmd_handler = curses_cmd_handler;
-      pinentry_set_flavor_flag ("curses");
+      pe_gnome3_probe (&probe);
+      if (!probe.prompt_available)
+        {
+          fprintf (stderr, "No Gcr System Prompter available,"
+                   " falling back to curses\n");
+          pinentry_cmd_handler = curses_cmd_handler;
+          pinentry_set_flavor_flag ("curses");
+        }
+      else if (probe.screen_locked)
+        {
+          fprintf (stderr, "GNOME screensaver is locked,"
+                   " falling back to curses\n");
+          pinentry_cmd_handler = curses_cmd_handler;
+          pinentry_set_flavor_flag ("curses");
+        }
     }
 #endif
 
   pinentry_parse_opts (argc, argv);
 
+  pinentry_set_idle_handler (close_session_prompt, PROMPT_IDLE_TIMEOUT);
+
   if (pinentry_loop ())
     return 1;
 
+  close_session_prompt ();
+
   return 0;
 }
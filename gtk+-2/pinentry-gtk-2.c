@@ -48,6 +48,7 @@
 #endif				/* HAVE_GETOPT_H */
 
 #include "pinentry.h"
+#include "secmem-util.h"
 
 #ifdef FALLBACK_CURSES
 #include "pinentry-curses.h"
@@ -73,6 +74,7 @@ static GtkWidget *error_label;
 static GtkWidget *qualitybar;
 static gboolean got_input;
 static guint timeout_source;
+static guint heartbeat_source;
 static int confirm_mode;
 
 /* Gnome hig small and large space in pixels.  */
@@ -87,6 +89,37 @@ static int confirm_mode;
  * and vice versa.  */
 #define QUALITYBAR_EMPTY_TEXT " "
 
+/* The quality inquiries are run by a worker thread, so that a slow
+ * answer from gpg-agent does not freeze the dialog.  TEXT holds the
+ * passphrase to evaluate next, if any; a newer text replaces an older
+ * one which has not yet been picked up.  SERIAL identifies the most
+ * recent text; results for older texts are dropped.
+ *
+ * Neither the Assuan context nor the secure memory functions are
+ * thread-safe.  While BUSY is set, the worker owns the Assuan context
+ * and the main thread must not touch it; BUSY is only changed with
+ * LOCK held, so the main thread may use the context for a short time
+ * by holding LOCK and checking BUSY.  Before returning to the command
+ * loop, the main thread stops the worker with quality_stop.  */
+static struct
+{
+  GMutex lock;
+  GCond cond;
+  GThread *thread;
+  char *text;
+  size_t length;
+  guint serial;
+  int stop;
+  int busy;
+} quality;
+
+/* The result of a quality inquiry, passed to the main thread.  */
+struct quality_result
+{
+  guint serial;
+  int percent;
+};
+
 
 /* Constrain size of the window the window should not shrink beyond
    the requisition, and should not grow vertically.  */
@@ -306,9 +339,8 @@ button_clicked (GtkWidget *widget, gpointer data)
         }
 
       passphrase_ok = 1;
-      pinentry_setbufferlen (pinentry, strlen (s) + 1);
-      if (pinentry->pin)
-	strcpy (pinentry->pin, s);
+      quality_stop ();
+      pinentry_setbuffer_copy (pinentry, s, strlen (s));
     }
   gtk_main_quit ();
 }
@@ -364,37 +396,19 @@ pinentry_utf8_validate (gchar *text)
 }
 
 
-/* Handler called for "changed".   We use it to update the quality
-   indicator.  */
+/* Show PERCENT in the quality bar.  EMPTY is true if there is no
+   passphrase at all.  */
 static void
-changed_text_handler (GtkWidget *widget)
+set_quality (int percent, int empty)
 {
   char textbuf[50];
-  const char *s;
-  int length;
-  int percent;
   GdkColor color = { 0, 0, 0, 0};
 
-  got_input = TRUE;
-
-  if (pinentry->repeat_passphrase && repeat_entry)
-    {
-      gtk_entry_set_text (GTK_ENTRY (repeat_entry), "");
-      gtk_label_set_text (GTK_LABEL (error_label), "");
-    }
-
-  if (!qualitybar || !pinentry->quality_bar)
-    return;
-
-  s = gtk_entry_get_text (GTK_ENTRY (widget));
-  if (!s)
-    s = "";
-  length = strlen (s);
-  percent = length? pinentry_inq_quality (pinentry, s, length) : 0;
-  if (!length)
+  if (empty)
     {
       strcpy(textbuf, QUALITYBAR_EMPTY_TEXT);
       color.red = 0xffff;
+      percent = 0;
     }
   else if (percent < 0)
     {
@@ -414,6 +428,153 @@ changed_text_handler (GtkWidget *widget)
 }
 
 
+/* Free TEXT of LENGTH after wiping it.  */
+static void
+quality_free_text (char *text, size_t length)
+{
+  if (text)
+    {
+      wipememory (text, length);
+      g_free (text);
+    }
+}
+
+
+/* Idle handler to apply the result of a quality inquiry.  */
+static gboolean
+quality_result_cb (gpointer data)
+{
+  struct quality_result *result = data;
+  int current;
+
+  g_mutex_lock (&quality.lock);
+  current = (result->serial == quality.serial);
+  g_mutex_unlock (&quality.lock);
+
+  if (current && qualitybar)
+    set_quality (result->percent, 0);
+
+  g_free (result);
+  return FALSE;
+}
+
+
+/* The worker thread running the quality inquiries for the pinentry
+   DATA.  */
+static gpointer
+quality_thread (gpointer data)
+{
+  pinentry_t pe = data;
+  struct quality_result *result;
+  char *text;
+  size_t length;
+  guint serial;
+
+  g_mutex_lock (&quality.lock);
+  for (;;)
+    {
+      while (!quality.text && !quality.stop)
+        g_cond_wait (&quality.cond, &quality.lock);
+      if (quality.stop)
+        break;
+
+      text = quality.text;
+      length = quality.length;
+      serial = quality.serial;
+      quality.text = NULL;
+      quality.busy = 1;
+      g_mutex_unlock (&quality.lock);
+
+      result = g_malloc (sizeof *result);
+      result->serial = serial;
+      result->percent = pinentry_inq_quality (pe, text, length);
+      quality_free_text (text, length);
+      g_idle_add (quality_result_cb, result);
+
+      g_mutex_lock (&quality.lock);
+      quality.busy = 0;
+    }
+  g_mutex_unlock (&quality.lock);
+
+  return NULL;
+}
+
+
+/* Queue TEXT of LENGTH for a quality inquiry.  An empty text only
+   invalidates outstanding results.  */
+static void
+quality_request (const char *text, size_t length)
+{
+  g_mutex_lock (&quality.lock);
+  quality.serial++;
+  quality_free_text (quality.text, quality.length);
+  quality.text = length? g_strndup (text, length) : NULL;
+  quality.length = length;
+  if (quality.text && !quality.thread)
+    {
+      quality.stop = 0;
+      quality.thread = g_thread_new ("quality", quality_thread, pinentry);
+    }
+  g_cond_signal (&quality.cond);
+  g_mutex_unlock (&quality.lock);
+}
+
+
+/* Stop the worker thread after its current inquiry and drop all
+   pending requests and results.  */
+static void
+quality_stop (void)
+{
+  GThread *thread;
+
+  g_mutex_lock (&quality.lock);
+  thread = quality.thread;
+  quality.thread = NULL;
+  quality.stop = 1;
+  quality.serial++;
+  quality_free_text (quality.text, quality.length);
+  quality.text = NULL;
+  g_cond_signal (&quality.cond);
+  g_mutex_unlock (&quality.lock);
+
+  if (thread)
+    g_thread_join (thread);
+  g_assert (!quality.busy);
+}
+
+
+/* Handler called for "changed".   We use it to update the quality
+   indicator.  */
+static void
+changed_text_handler (GtkWidget *widget)
+{
+  const char *s;
+  int length;
+
+  got_input = TRUE;
+
+  if (pinentry->repeat_passphrase && repeat_entry)
+    {
+      gtk_entry_set_text (GTK_ENTRY (repeat_entry), "");
+      gtk_label_set_text (GTK_LABEL (error_label), "");
+    }
+
+  if (!qualitybar || !pinentry->quality_bar)
+    return;
+
+  s = gtk_entry_get_text (GTK_ENTRY (widget));
+  if (!s)
+    s = "";
+  length = strlen (s);
+
+  /* The bar keeps showing the last result until the inquiry for the
+     new text has been answered.  */
+  quality_request (s, length);
+  if (!length)
+    set_quality (0, 1);
+}
+
+
 /* Called upon a press on Backspace in the entry widget.
    Used to completely disable echoing if we got no prior input. */
 static void
@@ -551,6 +712,20 @@ timeout_cb (gpointer data)
 }
 
 
+static gboolean
+heartbeat_cb (gpointer data)
+{
+  /* The quality worker may be using the Assuan context; skip this
+     heartbeat then.  Holding the lock keeps it from starting an
+     inquiry meanwhile.  */
+  g_mutex_lock (&quality.lock);
+  if (!quality.busy)
+    pinentry_heartbeat ((pinentry_t)data);
+  g_mutex_unlock (&quality.lock);
+  return TRUE;
+}
+
+
 static GtkWidget *
 create_show_hide_button (void)
 {
@@ -906,6 +1081,10 @@ create_window (pinentry_t ctx)
   if (pinentry->timeout > 0)
     timeout_source = g_timeout_add (pinentry->timeout*1000, timeout_cb, pinentry);
 
+  if (pinentry_heartbeat_interval (pinentry))
+    heartbeat_source = g_timeout_add (pinentry_heartbeat_interval (pinentry),
+                                      heartbeat_cb, pinentry);
+
   return win;
 }
 
@@ -923,6 +1102,10 @@ gtk_cmd_handler (pinentry_t pe)
   confirm_mode = want_pass ? 0 : 1;
   w = create_window (pe);
   gtk_main ();
+  /* No more inquiries past this point; the Assuan context is needed
+     again by our caller.  */
+  quality_stop ();
+  g_assert (!quality.thread);
   gtk_widget_destroy (w);
   while (gtk_events_pending ())
     gtk_main_iteration ();
@@ -933,6 +1116,11 @@ gtk_cmd_handler (pinentry_t pe)
       g_source_remove (timeout_source);
       timeout_source = 0;
     }
+  if (heartbeat_source)
+    {
+      g_source_remove (heartbeat_source);
+      heartbeat_source = 0;
+    }
 
   if (confirm_value == CONFIRM_CANCEL || grab_failed)
     pe->canceled = 1;
@@ -958,6 +1146,9 @@ main (int argc, char *argv[])
 {
   pinentry_init (PGMNAME);
 
+  g_mutex_init (&quality.lock);
+  g_cond_init (&quality.cond);
+
 #ifdef FALLBACK_CURSES
   if (pinentry_have_display (argc, argv))
     {
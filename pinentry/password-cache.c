@@ -105,6 +105,7 @@ password_cache_lookup (const char *keygrip, int *fatal_error)
   GError *error = NULL;
   char *password;
   char *password2;
+  size_t n;
 
   if (! *keygrip)
     return NULL;
@@ -128,9 +129,10 @@ password_cache_lookup (const char *keygrip, int *fatal_error)
     return NULL;
 
   /* The password needs to be returned in secmem allocated memory.  */
-  password2 = secmem_malloc (strlen (password) + 1);
+  n = strlen (password) + 1;
+  password2 = secmem_malloc (n);
   if (password2)
-    strcpy(password2, password);
+    memcpy (password2, password, n);
   else
     fprintf (stderr, "secmem_malloc failed: can't copy password!\n");
 
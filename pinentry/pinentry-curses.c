@@ -1561,6 +1561,9 @@ dialog_run (pinentry_t pinentry, const char *tty_name, const char *tty_type)
 	}
 #endif
 
+      /* The 70ms input timeout doubles as our heartbeat timer.  */
+      pinentry_heartbeat (pinentry);
+
       switch (c)
 	{
 	case ERR:
@@ -41,6 +41,7 @@
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <poll.h>
 #ifdef HAVE_UTIME_H
 #include <utime.h>
 #endif /*HAVE_UTIME_H*/
@@ -84,11 +85,53 @@ static int initial_timeout = INITIAL_TIMEOUT;
                        + strlen ((ptr)->sun_path))
 #endif
 
-/* FIXME: We could use the I/O functions in Assuan directly, once
+/* Upper limit for the receive buffer.  A single line must fit into
+   it.  */
+#define RECV_BUFFER_MAX (4 * (LINELENGTH + 1))
+
+/* The connection to Emacs.  It is established once and then kept
+   open, so that all GETPIN and CONFIRM requests of a session are
+   forwarded over the same socket.
+
+   Requests are only queued in SEND_BUFFER and written out when a
+   response is actually needed.  Emacs answers them in order; PENDING
+   counts the responses which have not yet been read.
+
+   RECV_BUFFER holds data read from the socket but not yet consumed,
+   at RECV_BUFFER[RECV_START..RECV_END).  It is allocated from secure
+   memory, as it may carry the passphrase, and grows on demand up to
+   RECV_BUFFER_MAX bytes.  The bytes before RECV_SCAN are known not
+   to contain a line feed, so that each byte is scanned only once.
+   LINE_STATE tells how the rest of a partially received line is to
+   be handled; data lines are passed on while they are received and
+   thus may be of any length.
+
+   FIXME: We could use the I/O functions in Assuan directly, once
    Pinentry links to libassuan.  */
-static int emacs_socket = -1;
-static char send_buffer[SEND_BUFFER_SIZE + 1];
-static int send_buffer_length; /* Fill pointer for the send buffer.  */
+struct emacs_conn
+{
+  int fd;
+  char send_buffer[SEND_BUFFER_SIZE];
+  size_t send_length;
+  char *recv_buffer;
+  size_t recv_size;
+  size_t recv_start;
+  size_t recv_end;
+  size_t recv_scan;
+  enum { LINE_START, LINE_DATA, LINE_SKIP } line_state;
+  int pending;
+};
+
+/* A buffer in secure memory to collect the data lines of a
+   response.  */
+struct emacs_data
+{
+  char *buffer;
+  size_t length;
+  size_t size;
+};
+
+static struct emacs_conn emacs_conn = { -1 };
 
 static pinentry_cmd_handler_t fallback_cmd_handler;
 
@@ -175,19 +218,19 @@ set_socket (const char *socket_name)
       return 0;
     }
 
-  emacs_socket = socket (AF_UNIX, SOCK_STREAM, 0);
-  if (emacs_socket < 0)
+  emacs_conn.fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (emacs_conn.fd < 0)
     {
       perror ("socket");
       return 0;
     }
 
-  if (connect (emacs_socket, (struct sockaddr *) &unaddr,
+  if (connect (emacs_conn.fd, (struct sockaddr *) &unaddr,
 	       SUN_LEN (&unaddr)) < 0)
     {
       perror ("connect");
-      close (emacs_socket);
-      emacs_socket = -1;
+      close (emacs_conn.fd);
+      emacs_conn.fd = -1;
       return 0;
     }
 
@@ -265,73 +308,232 @@ unescape (char *data)
   return data;
 }
 
-/* Let's send the data to Emacs when either
-   - the data ends in "\n", or
-   - the buffer is full (but this shouldn't happen)
-   Otherwise, we just accumulate it.  */
+/* Close the connection CONN and discard all buffered data.  */
+static void
+conn_close (struct emacs_conn *conn)
+{
+  if (conn->fd >= 0)
+    close (conn->fd);
+  conn->fd = -1;
+  conn->send_length = 0;
+  secmem_free (conn->recv_buffer);
+  conn->recv_buffer = NULL;
+  conn->recv_size = 0;
+  conn->recv_start = 0;
+  conn->recv_end = 0;
+  conn->recv_scan = 0;
+  conn->line_state = LINE_START;
+  conn->pending = 0;
+}
+
+/* Write all data queued in the send buffer of CONN to the socket.  */
 static int
-send_to_emacs (int s, const char *buffer)
+conn_flush (struct emacs_conn *conn)
 {
-  size_t length;
+  size_t offset = 0;
 
-  length = strlen (buffer);
-  while (*buffer)
+  while (offset < conn->send_length)
     {
-      size_t part = MIN (length, SEND_BUFFER_SIZE - send_buffer_length);
-      memcpy (&send_buffer[send_buffer_length], buffer, part);
-      buffer += part;
-      send_buffer_length += part;
+      ssize_t sent;
 
-      if (send_buffer_length == SEND_BUFFER_SIZE
-	  || (send_buffer_length > 0
-	      && send_buffer[send_buffer_length-1] == '\n'))
+      sent = send (conn->fd, conn->send_buffer + offset,
+		   conn->send_length - offset, 0);
+      if (sent < 0 && errno == EINTR)
+	continue;
+      if (sent < 0)
 	{
-	  int sent = send (s, send_buffer, send_buffer_length, 0);
-	  if (sent < 0)
-	    {
-	      fprintf (stderr, "failed to send %d bytes to socket: %s\n",
-		       send_buffer_length, strerror (errno));
-	      send_buffer_length = 0;
-	      return 0;
-	    }
-	  if (sent != send_buffer_length)
-	    memmove (send_buffer, &send_buffer[sent],
-		     send_buffer_length - sent);
-	  send_buffer_length -= sent;
+	  fprintf (stderr, "failed to send %lu bytes to socket: %s\n",
+		   (unsigned long) (conn->send_length - offset),
+		   strerror (errno));
+	  conn->send_length = 0;
+	  return 0;
 	}
+      offset += sent;
+    }
+  conn->send_length = 0;
+
+  return 1;
+}
+
+/* Append BUFFER to the send buffer of CONN.  The data is written to
+   the socket only when the buffer is full or by conn_flush.  */
+static int
+conn_queue (struct emacs_conn *conn, const char *buffer)
+{
+  size_t length;
 
+  length = strlen (buffer);
+  while (length)
+    {
+      size_t part = MIN (length, SEND_BUFFER_SIZE - conn->send_length);
+      memcpy (&conn->send_buffer[conn->send_length], buffer, part);
+      conn->send_length += part;
+      buffer += part;
       length -= part;
+
+      if (conn->send_length == SEND_BUFFER_SIZE && !conn_flush (conn))
+	return 0;
     }
 
   return 1;
 }
 
-/* Read a server response.  If the response contains data, it will be
-   stored in BUFFER with a terminating NUL byte.  BUFFER must be
-   at least as large as CAPACITY.  */
+/* Queue the request NAME with the optional argument VALUE, which is
+   escaped as needed.  */
+static int
+conn_queue_request (struct emacs_conn *conn, const char *name,
+		    const char *value)
+{
+  char *escaped = NULL;
+  int retval;
+
+  if (value)
+    {
+      escaped = escape (value);
+      if (!escaped)
+	return 0;
+    }
+
+  retval = conn_queue (conn, name)
+    && (!escaped
+	|| (conn_queue (conn, " ") && conn_queue (conn, escaped)))
+    && conn_queue (conn, "\n");
+
+  free (escaped);
+  if (!retval)
+    return 0;
+
+  conn->pending++;
+  return 1;
+}
+
+/* Set DEADLINE to TIMEOUT seconds from now.  A TIMEOUT of 0 means
+   to wait forever, which is indicated by a zero DEADLINE.  */
+static void
+set_deadline (struct timespec *deadline, int timeout)
+{
+  deadline->tv_sec = 0;
+  deadline->tv_nsec = 0;
+  if (timeout > 0 && !clock_gettime (CLOCK_MONOTONIC, deadline))
+    deadline->tv_sec += timeout;
+}
+
+/* Return the number of milliseconds left until DEADLINE in the form
+   expected by poll.  */
+static int
+deadline_remaining (const struct timespec *deadline)
+{
+  struct timespec now;
+  long long ms;
+
+  if (!deadline->tv_sec && !deadline->tv_nsec)
+    return -1;
+  if (clock_gettime (CLOCK_MONOTONIC, &now))
+    return 0;
+
+  ms = (long long) (deadline->tv_sec - now.tv_sec) * 1000
+    + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+  if (ms < 0)
+    return 0;
+  if (ms > INT_MAX)
+    return INT_MAX;
+  return (int) ms;
+}
+
+/* Append LENGTH bytes at P to DATA and keep it NUL terminated.  */
+static gpg_error_t
+data_append (struct emacs_data *data, const char *p, size_t length)
+{
+  if (data->length + length + 1 < data->length)
+    return gpg_error (GPG_ERR_ASS_GENERAL);  /* Overflow.  */
+
+  if (data->length + length + 1 > data->size)
+    {
+      size_t size = data->size ? data->size : LINELENGTH;
+      char *buffer;
+
+      while (size < data->length + length + 1)
+	size *= 2;
+      buffer = secmem_malloc (size);
+      if (!buffer)
+	return gpg_error (GPG_ERR_ENOMEM);
+      if (data->buffer)
+	{
+	  memcpy (buffer, data->buffer, data->length);
+	  secmem_free (data->buffer);
+	}
+      data->buffer = buffer;
+      data->size = size;
+    }
+
+  memcpy (data->buffer + data->length, p, length);
+  data->length += length;
+  data->buffer[data->length] = 0;
+  return 0;
+}
+
+/* Wait until DEADLINE for data from Emacs and append it to the
+   receive buffer of CONN.  */
 static gpg_error_t
-read_from_emacs (int s, int timeout, char *buffer, size_t capacity)
+conn_fill (struct emacs_conn *conn, const struct timespec *deadline)
 {
-  struct timeval tv;
-  fd_set rfds;
+  struct pollfd pfd;
   int retval;
-  /* Offset in BUFFER.  */
-  size_t offset = 0;
-  int got_response = 0;
-  char read_buffer[LINELENGTH + 1];
-  /* Offset in READ_BUFFER.  */
-  size_t read_offset = 0;
-  gpg_error_t result = 0;
+  ssize_t rl;
+
+  if (conn->fd < 0)
+    return gpg_error (GPG_ERR_EOF);
+
+  /* Move the unconsumed data to the front and make room for more.  */
+  if (conn->recv_start)
+    {
+      memmove (conn->recv_buffer, conn->recv_buffer + conn->recv_start,
+	       conn->recv_end - conn->recv_start);
+      conn->recv_end -= conn->recv_start;
+      conn->recv_scan -= conn->recv_start;
+      conn->recv_start = 0;
+    }
+  if (conn->recv_end == conn->recv_size)
+    {
+      size_t size;
+      char *p;
 
-  tv.tv_sec = timeout;
-  tv.tv_usec = 0;
+      size = conn->recv_size ? 2 * conn->recv_size : LINELENGTH + 1;
+      if (size > RECV_BUFFER_MAX)
+	{
+	  /* We can't resynchronize after that.  */
+	  fprintf (stderr, "response line too long\n");
+	  conn_close (conn);
+	  return gpg_error (GPG_ERR_ASS_LINE_TOO_LONG);
+	}
+
+      p = secmem_malloc (size);
+      if (!p)
+	return gpg_error (GPG_ERR_ENOMEM);
+      if (conn->recv_buffer)
+	{
+	  memcpy (p, conn->recv_buffer, conn->recv_end);
+	  secmem_free (conn->recv_buffer);
+	}
+      conn->recv_buffer = p;
+      conn->recv_size = size;
+    }
 
-  FD_ZERO (&rfds);
-  FD_SET (s, &rfds);
-  retval = select (s + 1, &rfds, NULL, NULL, &tv);
-  if (retval == -1)
+  /* If we receive a signal (e.g. SIGWINCH, which we pass through to
+     Emacs, or the SIGALRM of our own timeout), on some OSes we get
+     EINTR and must retry with the remaining time.  */
+  do
     {
-      perror ("select");
+      pfd.fd = conn->fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      retval = poll (&pfd, 1, deadline_remaining (deadline));
+    }
+  while (retval < 0 && errno == EINTR);
+
+  if (retval < 0)
+    {
+      perror ("poll");
       return gpg_error (GPG_ERR_ASS_GENERAL);
     }
   else if (retval == 0)
@@ -340,205 +542,244 @@ read_from_emacs (int s, int timeout, char *buffer, size_t capacity)
       return gpg_error (GPG_ERR_TIMEOUT);
     }
 
-  /* Loop until we get either OK or ERR.  */
-  while (!got_response)
+  do
     {
-      int rl = 0;
-      char *p, *end_p;
-      do
-	{
-	  errno = 0;
-	  rl = recv (s, read_buffer + read_offset, LINELENGTH - read_offset, 0);
-	}
-      /* If we receive a signal (e.g. SIGWINCH, which we pass
-	 through to Emacs), on some OSes we get EINTR and must retry. */
-      while (rl < 0 && errno == EINTR);
+      errno = 0;
+      rl = recv (conn->fd, conn->recv_buffer + conn->recv_end,
+		 conn->recv_size - conn->recv_end, 0);
+    }
+  while (rl < 0 && errno == EINTR);
+
+  if (rl < 0)
+    {
+      perror ("recv");
+      return gpg_error (GPG_ERR_ASS_GENERAL);
+    }
+  if (rl == 0)
+    {
+      fprintf (stderr, "connection closed by Emacs\n");
+      conn_close (conn);
+      return gpg_error (GPG_ERR_EOF);
+    }
+
+  conn->recv_end += rl;
+  return 0;
+}
+
+/* Handle the start of a line in the receive buffer of CONN for which
+   the line feed has not yet been received.  The data of a data line
+   is moved to DATA right away, and the rest of a comment is
+   skipped.  */
+static gpg_error_t
+conn_handle_partial_line (struct emacs_conn *conn, struct emacs_data *data)
+{
+  char *p = conn->recv_buffer + conn->recv_start;
+  size_t length = conn->recv_end - conn->recv_start;
+  gpg_error_t err = 0;
 
-      if (rl < 0)
+  if (conn->line_state == LINE_START)
+    {
+      if (length >= 2 && !strncmp ("D ", p, 2))
 	{
-	  perror ("recv");
-	  return gpg_error (GPG_ERR_ASS_GENERAL);;
+	  conn->line_state = LINE_DATA;
+	  p += 2;
+	  length -= 2;
 	}
-      if (rl == 0)
-	break;
+      else if (length && *p == '#')
+	conn->line_state = LINE_SKIP;
+      else
+	return 0;
+    }
 
-      read_offset += rl;
-      read_buffer[read_offset] = '\0';
+  if (conn->line_state == LINE_DATA && data && length)
+    err = data_append (data, p, length);
 
-      end_p = strchr (read_buffer, '\n');
+  conn->recv_start = conn->recv_scan = conn->recv_end;
+  return err;
+}
 
-      /* If the buffer is filled without NL, throw away the content
-	 and start over the buffering.
+/* Read the next response from CONN, waiting until DEADLINE.  If the
+   response contains data, it will be stored in DATA; DATA may be NULL
+   if no data is expected.  Returns the error code sent by Emacs with
+   ERR, or another error if no complete response could be read.  In
+   the latter case the response is still pending.  */
+static gpg_error_t
+conn_read_response (struct emacs_conn *conn, const struct timespec *deadline,
+		    struct emacs_data *data)
+{
+  gpg_error_t err;
 
-	 FIXME: We could return ASSUAN_Line_Too_Long or
-	 ASSUAN_Line_Not_Terminated here.  */
-      if (!end_p && read_offset == sizeof (read_buffer) - 1)
+  /* Loop until we get either OK or ERR.  */
+  for (;;)
+    {
+      char *p, *end_p = NULL;
+      int line_state;
+
+      if (conn->recv_end > conn->recv_scan)
+	end_p = memchr (conn->recv_buffer + conn->recv_scan, '\n',
+			conn->recv_end - conn->recv_scan);
+      if (!end_p)
 	{
-	  read_offset = 0;
+	  conn->recv_scan = conn->recv_end;
+	  err = conn_handle_partial_line (conn, data);
+	  if (!err)
+	    err = conn_fill (conn, deadline);
+	  if (err)
+	    return err;
 	  continue;
 	}
 
-      /* Loop over all NL-terminated messages.  */
-      for (p = read_buffer; end_p; p = end_p + 1, end_p = strchr (p, '\n'))
+      p = conn->recv_buffer + conn->recv_start;
+      *end_p = '\0';
+      conn->recv_start = conn->recv_scan = end_p + 1 - conn->recv_buffer;
+      line_state = conn->line_state;
+      conn->line_state = LINE_START;
+
+      if (line_state == LINE_DATA)
 	{
-	  *end_p = '\0';
-	  if (!strncmp ("D ", p, 2))
+	  if (data && end_p > p)
 	    {
-	      char *data;
-	      size_t data_length;
-	      size_t needed_capacity;
-
-	      data = p + 2;
-	      data_length = end_p - data;
-	      if (data_length > 0)
-		{
-		  needed_capacity = offset + data_length + 1;
-
-		  /* Check overflow.  This is unrealistic but can
-		     happen since OFFSET is cumulative.  */
-		  if (needed_capacity < offset)
-		    return gpg_error (GPG_ERR_ASS_GENERAL);;
-
-		  if (needed_capacity > capacity)
-		    return gpg_error (GPG_ERR_ASS_GENERAL);;
-
-		  memcpy (&buffer[offset], data, data_length);
-		  offset += data_length;
-		  buffer[offset] = 0;
-		}
+	      err = data_append (data, p, end_p - p);
+	      if (err)
+		return err;
 	    }
-          else if (!strcmp ("OK", p) || !strncmp ("OK ", p, 3))
-            {
-	      got_response = 1;
-	      break;
-            }
-          else if (!strncmp ("ERR ", p, 4))
-            {
-	      unsigned long code = strtoul (p + 4, NULL, 10);
-	      if (code == ULONG_MAX && errno == ERANGE)
-		return gpg_error (GPG_ERR_ASS_GENERAL);
-	      else
-		result = code;
-	      got_response = 1;
-	      break;
-            }
-	  else if (*p == '#')
-	    ;
-	  else
-	    fprintf (stderr, "invalid response: %s\n", p);
 	}
-
-      if (!got_response)
+      else if (line_state == LINE_SKIP)
+	;
+      else if (!strncmp ("D ", p, 2))
 	{
-	  size_t length = &read_buffer[read_offset] - p;
-	  memmove (read_buffer, p, length);
-	  read_offset = length;
+	  if (data && end_p > p + 2)
+	    {
+	      err = data_append (data, p + 2, end_p - (p + 2));
+	      if (err)
+		return err;
+	    }
 	}
-    }
+      else if (!strcmp ("OK", p) || !strncmp ("OK ", p, 3))
+	{
+	  conn->pending--;
+	  return 0;
+	}
+      else if (!strncmp ("ERR ", p, 4))
+	{
+	  unsigned long code;
 
-  return result;
+	  conn->pending--;
+	  errno = 0;
+	  code = strtoul (p + 4, NULL, 10);
+	  if (code == ULONG_MAX && errno == ERANGE)
+	    return gpg_error (GPG_ERR_ASS_GENERAL);
+	  return code;
+	}
+      else if (*p == '#')
+	;
+      else
+	fprintf (stderr, "invalid response: %s\n", p);
+    }
 }
 
-int
-set_label (pinentry_t pe, const char *name, const char *value)
+/* Send all queued requests of CONN and read the response to the last
+   one into DATA as described for conn_read_response.  The responses
+   to the earlier requests, e.g. those from queue_labels, are not of
+   interest and thus skipped; failed labels are ignored as they ever
+   have been.  TIMEOUT applies to the whole transaction.  */
+static gpg_error_t
+conn_transact (struct emacs_conn *conn, int timeout, struct emacs_data *data)
 {
-  char buffer[16], *escaped;
-  gpg_error_t error;
-  int retval;
+  struct timespec deadline;
+  gpg_error_t err;
 
-  if (!send_to_emacs (emacs_socket, name)
-      || !send_to_emacs (emacs_socket, " "))
-    return 0;
+  if (!conn_flush (conn))
+    return gpg_error (GPG_ERR_ASS_GENERAL);
 
-  escaped = escape (value);
-  if (!escaped)
-    return 0;
+  set_deadline (&deadline, timeout);
+  while (conn->pending > 1)
+    {
+      int pending = conn->pending;
 
-  retval = send_to_emacs (emacs_socket, escaped)
-    && send_to_emacs (emacs_socket, "\n");
+      err = conn_read_response (conn, &deadline, NULL);
+      if (err && (conn->fd < 0 || conn->pending == pending))
+	return err;  /* Not a response but a read error.  */
+    }
 
-  free (escaped);
-  if (!retval)
-    return 0;
+  return conn_read_response (conn, &deadline, data);
+}
 
-  error = read_from_emacs (emacs_socket, pe->timeout, buffer, sizeof (buffer));
-  return error == 0;
+static int
+queue_label (const char *name, const char *value)
+{
+  return conn_queue_request (&emacs_conn, name, value);
 }
 
-static void
-set_labels (pinentry_t pe)
+/* Queue all labels for PE.  They are sent to Emacs in one go along
+   with the actual request.  */
+static int
+queue_labels (pinentry_t pe)
 {
   char *p;
+  int retval = 1;
 
   p = pinentry_get_title (pe);
   if (p)
     {
-      set_label (pe, "SETTITLE", p);
+      retval = queue_label ("SETTITLE", p);
       free (p);
     }
-  if (pe->description)
-    set_label (pe, "SETDESC", pe->description);
-  if (pe->error)
-    set_label (pe, "SETERROR", pe->error);
-  if (pe->prompt)
-    set_label (pe, "SETPROMPT", pe->prompt);
-  else if (pe->default_prompt)
-    set_label (pe, "SETPROMPT", pe->default_prompt);
-  if (pe->repeat_passphrase)
-    set_label (pe, "SETREPEAT", pe->repeat_passphrase);
-  if (pe->repeat_error_string)
-    set_label (pe, "SETREPEATERROR", pe->repeat_error_string);
+  if (retval && pe->description)
+    retval = queue_label ("SETDESC", pe->description);
+  if (retval && pe->error)
+    retval = queue_label ("SETERROR", pe->error);
+  if (retval && pe->prompt)
+    retval = queue_label ("SETPROMPT", pe->prompt);
+  else if (retval && pe->default_prompt)
+    retval = queue_label ("SETPROMPT", pe->default_prompt);
+  if (retval && pe->repeat_passphrase)
+    retval = queue_label ("SETREPEAT", pe->repeat_passphrase);
+  if (retval && pe->repeat_error_string)
+    retval = queue_label ("SETREPEATERROR", pe->repeat_error_string);
 
   /* XXX: pe->quality_bar and pe->quality_bar_tt are not supported.  */
 
   /* Buttons.  */
-  if (pe->ok)
-    set_label (pe, "SETOK", pe->ok);
-  else if (pe->default_ok)
-    set_label (pe, "SETOK", pe->default_ok);
-  if (pe->cancel)
-    set_label (pe, "SETCANCEL", pe->cancel);
-  else if (pe->default_cancel)
-    set_label (pe, "SETCANCEL", pe->default_cancel);
-  if (pe->notok)
-    set_label (pe, "SETNOTOK", pe->notok);
+  if (retval && pe->ok)
+    retval = queue_label ("SETOK", pe->ok);
+  else if (retval && pe->default_ok)
+    retval = queue_label ("SETOK", pe->default_ok);
+  if (retval && pe->cancel)
+    retval = queue_label ("SETCANCEL", pe->cancel);
+  else if (retval && pe->default_cancel)
+    retval = queue_label ("SETCANCEL", pe->default_cancel);
+  if (retval && pe->notok)
+    retval = queue_label ("SETNOTOK", pe->notok);
+
+  return retval;
 }
 
 static int
 do_password (pinentry_t pe)
 {
-  char *buffer, *password;
-  size_t length = LINELENGTH;
+  struct emacs_data data = { NULL, 0, 0 };
+  char *password;
   gpg_error_t error;
 
-  set_labels (pe);
-
-  if (!send_to_emacs (emacs_socket, "GETPIN\n"))
+  if (!queue_labels (pe)
+      || !conn_queue_request (&emacs_conn, "GETPIN", NULL))
     return -1;
 
-  buffer = secmem_malloc (length);
-  if (!buffer)
-    {
-      pe->specific_err = gpg_error (GPG_ERR_ENOMEM);
-      return -1;
-    }
-
-  error = read_from_emacs (emacs_socket, pe->timeout, buffer, length);
+  error = conn_transact (&emacs_conn, pe->timeout, &data);
   if (error != 0)
     {
       if (gpg_err_code (error) == GPG_ERR_CANCELED)
 	pe->canceled = 1;
 
-      secmem_free (buffer);
+      secmem_free (data.buffer);
       pe->specific_err = error;
       return -1;
     }
 
-  password = unescape (buffer);
-  pinentry_setbufferlen (pe, strlen (password) + 1);
-  if (pe->pin)
-    strcpy (pe->pin, password);
-  secmem_free (buffer);
+  password = data.buffer ? unescape (data.buffer) : "";
+  pinentry_setbuffer_copy (pe, password, strlen (password));
+  secmem_free (data.buffer);
 
   if (pe->repeat_passphrase)
     pe->repeat_okay = 1;
@@ -551,15 +792,13 @@ do_password (pinentry_t pe)
 static int
 do_confirm (pinentry_t pe)
 {
-  char buffer[16];
   gpg_error_t error;
 
-  set_labels (pe);
-
-  if (!send_to_emacs (emacs_socket, "CONFIRM\n"))
+  if (!queue_labels (pe)
+      || !conn_queue_request (&emacs_conn, "CONFIRM", NULL))
     return 0;
 
-  error = read_from_emacs (emacs_socket, pe->timeout, buffer, sizeof (buffer));
+  error = conn_transact (&emacs_conn, pe->timeout, NULL);
   if (error != 0)
     {
       if (gpg_err_code (error) == GPG_ERR_CANCELED)
@@ -624,6 +863,13 @@ emacs_cmd_handler (pinentry_t pe)
     }
 #endif
 
+  /* Reconnect if Emacs has closed the connection in the meantime.  */
+  if (emacs_conn.fd < 0 && !pinentry_emacs_init ())
+    {
+      pe->specific_err = gpg_error (GPG_ERR_EOF);
+      return pe->pin ? -1 : 0;
+    }
+
   if (pe->pin)
     rc = do_password (pe);
   else
@@ -640,7 +886,7 @@ initial_emacs_cmd_handler (pinentry_t pe)
      value set through an Assuan option.  */
   initial_timeout = pe->timeout;
 
-  if (emacs_socket < 0)
+  if (emacs_conn.fd < 0)
     pinentry_emacs_init ();
 
   /* If we have successfully connected to Emacs, swap
@@ -648,7 +894,7 @@ initial_emacs_cmd_handler (pinentry_t pe)
      interactions will be forwarded to Emacs.  Otherwise, set it back
      to the original command handler saved as
      fallback_cmd_handler.  */
-  if (emacs_socket < 0)
+  if (emacs_conn.fd < 0)
     pinentry_cmd_handler = fallback_cmd_handler;
   else
     {
@@ -699,22 +945,23 @@ pinentry_emacs_status (void)
 int
 pinentry_emacs_init (void)
 {
-  char buffer[256];
+  struct timespec deadline;
   gpg_error_t error;
 
-  assert (emacs_socket < 0);
+  assert (emacs_conn.fd < 0);
 
   /* Check if we can connect to the Emacs server socket.  */
   if (!set_socket ("pinentry"))
     return 0;
 
-  /* Check if the server responds.  */
-  error = read_from_emacs (emacs_socket, initial_timeout,
-			   buffer, sizeof (buffer));
+  /* Check if the server responds.  Its greeting is read like the
+     response to a request.  */
+  emacs_conn.pending = 1;
+  set_deadline (&deadline, initial_timeout);
+  error = conn_read_response (&emacs_conn, &deadline, NULL);
   if (error != 0)
     {
-      close (emacs_socket);
-      emacs_socket = -1;
+      conn_close (&emacs_conn);
       return 0;
     }
   return 1;
@@ -23,6 +23,7 @@
 #endif
 
 #include <errno.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -31,9 +32,12 @@
 #include <assert.h>
 #ifndef HAVE_W32_SYSTEM
 # include <sys/utsname.h>
+# include <poll.h>
+# include <fcntl.h>
 #endif
 #include <locale.h>
 #include <limits.h>
+#include <time.h>
 
 #include <assuan.h>
 
@@ -58,6 +62,12 @@ struct pinentry pinentry;
 
 static const char *flavor_flag;
 
+#define DIM(v) (sizeof (v) / sizeof ((v)[0]))
+
+/* The frontend's idle handler and its timeout in seconds.  */
+static pinentry_idle_handler_t idle_handler;
+static int idle_timeout;
+
 /* Because gtk_init removes the --display arg from the command lines
  * and our command line parser is called after gtk_init (so that it
  * does not see gtk specific options) we don't have a way to get hold
@@ -66,208 +76,443 @@ static const char *flavor_flag;
  * parser.  */
 static char *remember_display;
 
+static void pinentry_reset (int use_defaults);
+static void strcpy_escaped (char *d, const char *s);
+
+
+/* The offset and size of FIELD in struct pinentry.  */
+#define PE_FIELD(field) offsetof (struct pinentry, field), \
+                        sizeof (((struct pinentry *)0)->field)
+#define PE_NOFIELD      0, 0
+
+/* How pinentry_reset treats a field of struct pinentry.  */
+enum reset_policy
+  {
+    RESET_CLEAR,  /* Set by a command; cleared by RESET if changed.  */
+    RESET_RESULT, /* Written while running GETPIN or CONFIRM; cleared
+                     by RESET if one of them ran.  */
+    RESET_KEEP    /* Survives RESET; set to DEFVAL by a full reset.  */
+  };
+
+struct field_desc
+{
+  size_t offset;
+  size_t size;
+  enum reset_policy policy;
+  int defval;
+};
+
+/* The reset policy of all fields of struct pinentry.  This table must
+   list the fields in the order of their declaration; it is searched
+   by offset.  */
+static const struct field_desc field_table[] =
+  {
+#define CLEAR(field)       { PE_FIELD (field), RESET_CLEAR, 0 }
+#define RESULT(field)      { PE_FIELD (field), RESET_RESULT, 0 }
+#define KEEP(field, dflt)  { PE_FIELD (field), RESET_KEEP, (dflt) }
+    CLEAR (title),
+    CLEAR (description),
+    CLEAR (error),
+    CLEAR (prompt),
+    CLEAR (ok),
+    CLEAR (notok),
+    CLEAR (cancel),
+    RESULT (pin),
+    RESULT (pin_len),
+    RESULT (pin_datalen),
+    RESULT (pin_from_cache),
+    KEEP (display, 0),
+    KEEP (ttyname, 0),
+    KEEP (ttytype_l, 0),
+    KEEP (ttyalert, 0),
+    KEEP (lc_ctype, 0),
+    KEEP (lc_messages, 0),
+    KEEP (debug, 0),
+    KEEP (timeout, 60),
+    KEEP (grab, 1),
+    KEEP (heartbeat, 0),
+    KEEP (owner_pid, 0),
+    KEEP (owner_uid, -1),
+    KEEP (owner_host, 0),
+    KEEP (parent_wid, 0),
+    KEEP (touch_file, 0),
+    RESULT (result),
+    RESULT (canceled),
+    RESULT (locale_err),
+    RESULT (specific_err),
+    RESULT (specific_err_loc),
+    RESULT (specific_err_info),
+    RESULT (close_button),
+    RESULT (one_button),
+    RESULT (confirm),
+    CLEAR (repeat_passphrase),
+    CLEAR (repeat_error_string),
+    CLEAR (repeat_ok_string),
+    RESULT (repeat_okay),
+    CLEAR (quality_bar),
+    CLEAR (quality_bar_tt),
+    CLEAR (genpin_label),
+    CLEAR (genpin_tt),
+    CLEAR (formatted_passphrase),
+    CLEAR (formatted_passphrase_hint),
+    KEEP (color_fg, PINENTRY_COLOR_DEFAULT),
+    KEEP (color_fg_bright, 0),
+    KEEP (color_bg, PINENTRY_COLOR_DEFAULT),
+    KEEP (color_so, PINENTRY_COLOR_DEFAULT),
+    KEEP (color_so_bright, 0),
+    KEEP (color_ok, PINENTRY_COLOR_DEFAULT),
+    KEEP (color_ok_bright, 0),
+    KEEP (color_qualitybar, PINENTRY_COLOR_DEFAULT),
+    KEEP (color_qualitybar_bright, 0),
+    KEEP (default_ok, 0),
+    KEEP (default_cancel, 0),
+    KEEP (default_prompt, 0),
+    KEEP (default_pwmngr, 0),
+    KEEP (default_cf_visi, 0),
+    KEEP (default_tt_visi, 0),
+    KEEP (default_tt_hide, 0),
+    KEEP (default_capshint, 0),
+    KEEP (allow_external_password_cache, 0),
+    RESULT (tried_password_cache),
+    CLEAR (keyinfo),
+    RESULT (may_cache_password),
+    RESULT (ctx_assuan),
+    KEEP (invisible_char, 0),
+    KEEP (constraints_enforce, 0),
+    KEEP (constraints_hint_short, 0),
+    KEEP (constraints_hint_long, 0),
+    KEEP (constraints_error_title, 0)
+#undef CLEAR
+#undef RESULT
+#undef KEEP
+  };
+
+/* The fields changed since the last reset.  */
+static struct
+{
+  unsigned char flags[DIM (field_table)];  /* Indexed like field_table.  */
+  unsigned char list[DIM (field_table)];   /* The indices of the set flags.  */
+  size_t count;
+  int results;  /* GETPIN or CONFIRM ran.  */
+} field_dirty;
+
+
+static int
+field_desc_cmp (const void *key, const void *elem)
+{
+  size_t offset = *(const size_t *)key;
+  size_t elem_offset = ((const struct field_desc *)elem)->offset;
+
+  return offset < elem_offset? -1 : offset > elem_offset;
+}
+
+
+/* Return the descriptor of the field at OFFSET in struct pinentry.  */
+static const struct field_desc *
+field_desc_at (size_t offset)
+{
+  const struct field_desc *fd;
+
+  fd = bsearch (&offset, field_table, DIM (field_table),
+                sizeof *field_table, field_desc_cmp);
+  assert (fd);
+  return fd;
+}
+
+
+/* Record that FIELD has been changed.  FIELD may point anywhere; only
+   fields of the global struct pinentry are tracked.  */
 static void
-pinentry_reset (int use_defaults)
+touch_field (const void *field)
 {
-  /* GPG Agent sets these options once when it starts the pinentry.
-     Don't reset them.  */
-  int grab = pinentry.grab;
-  char *ttyname = pinentry.ttyname;
-  char *ttytype = pinentry.ttytype_l;
-  char *ttyalert = pinentry.ttyalert;
-  char *lc_ctype = pinentry.lc_ctype;
-  char *lc_messages = pinentry.lc_messages;
-  int allow_external_password_cache = pinentry.allow_external_password_cache;
-  char *default_ok = pinentry.default_ok;
-  char *default_cancel = pinentry.default_cancel;
-  char *default_prompt = pinentry.default_prompt;
-  char *default_pwmngr = pinentry.default_pwmngr;
-  char *default_cf_visi = pinentry.default_cf_visi;
-  char *default_tt_visi = pinentry.default_tt_visi;
-  char *default_tt_hide = pinentry.default_tt_hide;
-  char *default_capshint = pinentry.default_capshint;
-  char *touch_file = pinentry.touch_file;
-  unsigned long owner_pid = pinentry.owner_pid;
-  int owner_uid = pinentry.owner_uid;
-  char *owner_host = pinentry.owner_host;
-  int constraints_enforce = pinentry.constraints_enforce;
-  char *constraints_hint_short = pinentry.constraints_hint_short;
-  char *constraints_hint_long = pinentry.constraints_hint_long;
-  char *constraints_error_title = pinentry.constraints_error_title;
-
-  /* These options are set from the command line.  Don't reset
-     them.  */
-  int debug = pinentry.debug;
-  char *display = pinentry.display;
-  int parent_wid = pinentry.parent_wid;
-
-  pinentry_color_t color_fg = pinentry.color_fg;
-  int color_fg_bright = pinentry.color_fg_bright;
-  pinentry_color_t color_bg = pinentry.color_bg;
-  pinentry_color_t color_so = pinentry.color_so;
-  int color_so_bright = pinentry.color_so_bright;
-  pinentry_color_t color_ok = pinentry.color_ok;
-  int color_ok_bright = pinentry.color_ok_bright;
-  pinentry_color_t color_qualitybar = pinentry.color_qualitybar;
-  int color_qualitybar_bright = pinentry.color_qualitybar_bright;
-
-  int timeout = pinentry.timeout;
-
-  char *invisible_char = pinentry.invisible_char;
-
-
-  /* Free any allocated memory.  */
-  if (use_defaults)
+  const char *p = field;
+  size_t idx;
+
+  if (p < (const char *)&pinentry || p >= (const char *)(&pinentry + 1))
+    return;
+  idx = field_desc_at (p - (const char *)&pinentry) - field_table;
+  if (!field_dirty.flags[idx])
     {
-      free (pinentry.ttyname);
-      free (pinentry.ttytype_l);
-      free (pinentry.ttyalert);
-      free (pinentry.lc_ctype);
-      free (pinentry.lc_messages);
-      free (pinentry.default_ok);
-      free (pinentry.default_cancel);
-      free (pinentry.default_prompt);
-      free (pinentry.default_pwmngr);
-      free (pinentry.default_cf_visi);
-      free (pinentry.default_tt_visi);
-      free (pinentry.default_tt_hide);
-      free (pinentry.default_capshint);
-      free (pinentry.touch_file);
-      free (pinentry.owner_host);
-      free (pinentry.display);
-      free (pinentry.constraints_hint_short);
-      free (pinentry.constraints_hint_long);
-      free (pinentry.constraints_error_title);
+      field_dirty.flags[idx] = 1;
+      field_dirty.list[field_dirty.count++] = idx;
     }
+}
 
-  free (pinentry.title);
-  free (pinentry.description);
-  free (pinentry.error);
-  free (pinentry.prompt);
-  free (pinentry.ok);
-  free (pinentry.notok);
-  free (pinentry.cancel);
-  secmem_free (pinentry.pin);
-  free (pinentry.repeat_passphrase);
-  free (pinentry.repeat_error_string);
-  free (pinentry.quality_bar);
-  free (pinentry.quality_bar_tt);
-  free (pinentry.formatted_passphrase_hint);
-  free (pinentry.keyinfo);
-  free (pinentry.specific_err_info);
 
-  /* Reset the pinentry structure.  */
-  memset (&pinentry, 0, sizeof (pinentry));
+/* The descriptive strings of struct pinentry are not malloced one by
+   one but carved from two bump arenas.  REQUEST_ARENA holds the
+   strings set for a single request (SETDESC, SETPROMPT, ...) and is
+   rewound by RESET.  SESSION_ARENA holds the strings which survive
+   RESET, that is the RESET_KEEP fields; it is only rewound by a full
+   reset.  A new value is stored in place of the old one if it fits.
+   Otherwise the old value is given back if it was the last
+   allocation; if not, its space is wasted until the arena is rewound
+   or, if more than ARENA_MAX_WASTE bytes have been wasted, compacted.
+   Thus a long session which repeatedly changes a kept string does
+   not grow the session arena without bound.  */
+struct arena_block
+{
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  char data[1];
+};
+
+struct arena
+{
+  struct arena_block *head;  /* The block we currently allocate from.  */
+  char *last;                /* The most recent allocation or NULL.  */
+  size_t wasted;             /* Bytes not in use by any field.  */
+  char **fields[DIM (field_table)];  /* The fields set from the arena.  */
+  size_t nfields;
+};
 
-  /* Restore options without a default we want to preserve.  */
-  pinentry.invisible_char = invisible_char;
+#define ARENA_BLOCK_SIZE 1024
+#define ARENA_MAX_WASTE  (4 * ARENA_BLOCK_SIZE)
 
-  /* Restore other options or set defaults.  */
+static struct arena request_arena;
+static struct arena session_arena;
 
-  if (use_defaults)
+
+/* Allocate N bytes from arena A.  Returns NULL and sets ERRNO on
+   error.  */
+static char *
+arena_alloc (struct arena *a, size_t n)
+{
+  struct arena_block *b = a->head;
+  char *p;
+
+  if (!b || b->size - b->used < n)
     {
-      /* Pinentry timeout in seconds.  */
-      pinentry.timeout = 60;
-
-      /* Global grab.  */
-      pinentry.grab = 1;
-
-      pinentry.color_fg = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_fg_bright = 0;
-      pinentry.color_bg = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_so = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_so_bright = 0;
-      pinentry.color_ok = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_ok_bright = 0;
-      pinentry.color_qualitybar = PINENTRY_COLOR_DEFAULT;
-      pinentry.color_qualitybar_bright = 0;
-
-      pinentry.owner_uid = -1;
+      size_t size = n > ARENA_BLOCK_SIZE? n : ARENA_BLOCK_SIZE;
+
+      b = malloc (offsetof (struct arena_block, data) + size);
+      if (!b)
+        return NULL;
+      b->next = a->head;
+      b->size = size;
+      b->used = 0;
+      a->head = b;
     }
-  else /* Restore the options.  */
+
+  p = b->data + b->used;
+  b->used += n;
+  a->last = p;
+  return p;
+}
+
+
+/* Give all memory of arena A back except for its first block, which
+   is kept for reuse.  */
+static void
+arena_rewind (struct arena *a)
+{
+  struct arena_block *b;
+
+  while (a->head && a->head->next)
     {
-      pinentry.grab = grab;
-      pinentry.ttyname = ttyname;
-      pinentry.ttytype_l = ttytype;
-      pinentry.ttyalert = ttyalert;
-      pinentry.lc_ctype = lc_ctype;
-      pinentry.lc_messages = lc_messages;
-      pinentry.allow_external_password_cache = allow_external_password_cache;
-      pinentry.default_ok = default_ok;
-      pinentry.default_cancel = default_cancel;
-      pinentry.default_prompt = default_prompt;
-      pinentry.default_pwmngr = default_pwmngr;
-      pinentry.default_cf_visi = default_cf_visi;
-      pinentry.default_tt_visi = default_tt_visi;
-      pinentry.default_tt_hide = default_tt_hide;
-      pinentry.default_capshint = default_capshint;
-      pinentry.touch_file = touch_file;
-      pinentry.owner_pid = owner_pid;
-      pinentry.owner_uid = owner_uid;
-      pinentry.owner_host = owner_host;
-      pinentry.constraints_enforce = constraints_enforce;
-      pinentry.constraints_hint_short = constraints_hint_short;
-      pinentry.constraints_hint_long = constraints_hint_long;
-      pinentry.constraints_error_title = constraints_error_title;
-
-      pinentry.debug = debug;
-      pinentry.display = display;
-      pinentry.parent_wid = parent_wid;
-
-      pinentry.color_fg = color_fg;
-      pinentry.color_fg_bright = color_fg_bright;
-      pinentry.color_bg = color_bg;
-      pinentry.color_so = color_so;
-      pinentry.color_so_bright = color_so_bright;
-      pinentry.color_ok = color_ok;
-      pinentry.color_ok_bright = color_ok_bright;
-      pinentry.color_qualitybar = color_qualitybar;
-      pinentry.color_qualitybar_bright = color_qualitybar_bright;
-
-      pinentry.timeout = timeout;
+      b = a->head;
+      a->head = b->next;
+      free (b);
     }
+  if (a->head)
+    a->head->used = 0;
+  a->last = NULL;
+  a->wasted = 0;
+  a->nfields = 0;
 }
 
-static gpg_error_t
-pinentry_assuan_reset_handler (assuan_context_t ctx, char *line)
+
+/* Remember that FIELD points into arena A.  */
+static void
+arena_track (struct arena *a, char **field)
 {
-  (void)ctx;
-  (void)line;
+  size_t i;
+
+  for (i = 0; i < a->nfields; i++)
+    if (a->fields[i] == field)
+      return;
+  assert (a->nfields < DIM (a->fields));
+  a->fields[a->nfields++] = field;
+}
 
-  pinentry_reset (0);
 
+/* Move the strings of all fields set from arena A into a single new
+   block and free the old blocks.  On error the arena is left
+   alone.  */
+static void
+arena_compact (struct arena *a)
+{
+  struct arena_block *old = a->head;
+  struct arena_block *b;
+  size_t i, n, total = 0;
+  char *p;
+
+  for (i = 0; i < a->nfields; i++)
+    if (*a->fields[i])
+      total += strlen (*a->fields[i]) + 1;
+
+  a->head = NULL;
+  p = arena_alloc (a, total);
+  if (!p)
+    {
+      a->head = old;
+      return;
+    }
+  for (i = 0; i < a->nfields; i++)
+    if (*a->fields[i])
+      {
+        n = strlen (*a->fields[i]) + 1;
+        memcpy (p, *a->fields[i], n);
+        *a->fields[i] = p;
+        p += n;
+      }
+  a->last = NULL;
+  a->wasted = 0;
+
+  while (old)
+    {
+      b = old;
+      old = b->next;
+      free (b);
+    }
+}
+
+
+/* If *FIELD is the most recent allocation from arena A and the arena
+   has room for N bytes at that place, give the space back and return
+   true.  */
+static int
+arena_reclaim (struct arena *a, char **field, size_t n)
+{
+  size_t start;
+
+  if (!*field || *field != a->last)
+    return 0;
+  start = *field - a->head->data;
+  if (a->head->size - start < n)
+    return 0;
+  a->head->used = start;
+  a->last = NULL;
+  return 1;
+}
+
+
+/* Replace the string at *FIELD by a copy of S allocated from arena A.
+   If ESCAPED is set, S is percent-unescaped.  The space of the old
+   value is reused if the new value fits or if the old value was the
+   last allocation from A, so that repeating a command does not grow
+   the arena.  */
+static gpg_error_t
+arena_set_string (struct arena *a, char **field, const char *s, int escaped)
+{
+  size_t n = strlen (s) + 1;
+  size_t oldlen = *field? strlen (*field) + 1 : 0;
+  char *p;
+
+  if (oldlen >= n)
+    p = *field;  /* Fits in place.  */
+  else
+    {
+      if (oldlen && !arena_reclaim (a, field, n))
+        a->wasted += oldlen;
+      oldlen = 0;
+      p = arena_alloc (a, n);
+      if (!p)
+        return gpg_error_from_syserror ();
+      arena_track (a, field);
+    }
+  if (escaped)
+    strcpy_escaped (p, s);
+  else
+    memcpy (p, s, n);
+  if (oldlen)
+    a->wasted += oldlen - strlen (p) - 1;
+  *field = p;
+  touch_field (field);
+
+  if (a->wasted > ARENA_MAX_WASTE)
+    arena_compact (a);
   return 0;
 }
 
 
-
-/* Copy TEXT or TEXTLEN to BUFFER and escape as required.  Return a
-   pointer to the end of the new buffer.  Note that BUFFER must be
-   large enough to keep the entire text; allocataing it 3 times of
-   TEXTLEN is sufficient.  */
+/* Clear the string at *FIELD allocated from arena A.  */
+static void
+arena_clear_string (struct arena *a, char **field)
+{
+  if (*field && !arena_reclaim (a, field, 0))
+    a->wasted += strlen (*field) + 1;
+  *field = NULL;
+  touch_field (field);
+}
+
+
+/* Copy TEXT of TEXTLEN to BUFFER and escape as required.  Return a
+   pointer to the terminating Nul of the new buffer.  Note that BUFFER
+   must be large enough to keep the entire text; allocating it 3 times
+   TEXTLEN plus one is sufficient.  */
 static char *
 copy_and_escape (char *buffer, const void *text, size_t textlen)
 {
-  int i;
-  const unsigned char *s = (unsigned char *)text;
+  static const char hexdigits[] = "0123456789ABCDEF";
+  const unsigned char *s = text;
+  const unsigned char *end = s + textlen;
   char *p = buffer;
 
-  for (i=0; i < textlen; i++)
+  for (; s < end; s++)
     {
-      if (s[i] < ' ' || s[i] == '+')
-        {
-          snprintf (p, 4, "%%%02X", s[i]);
-          p += 3;
-        }
-      else if (s[i] == ' ')
+      if (*s > ' ' && *s != '+')
+        *p++ = *s;
+      else if (*s == ' ')
         *p++ = '+';
       else
-        *p++ = s[i];
+        {
+          *p++ = '%';
+          *p++ = hexdigits[*s >> 4];
+          *p++ = hexdigits[*s & 15];
+        }
     }
+  *p = 0;
   return p;
 }
 
 
+/* Percent-unescape the string S into D and return the length of the
+   result.  D may be S; otherwise it must have room for strlen(S)+1
+   bytes.  The runs between percent signs are copied at once.  */
+static size_t
+unescape_copy (char *d, const char *s)
+{
+  char *d0 = d;
+  const char *pct;
+  size_t n;
+
+  for (;;)
+    {
+      pct = strchr (s, '%');
+      n = pct? (size_t)(pct - s) : strlen (s);
+      if (d != s)
+        memmove (d, s, n);
+      d += n;
+      s += n;
+      if (!pct)
+        break;
+
+      if (s[1] && s[2])
+        {
+          *d++ = xtoi_2 (s + 1);
+          s += 3;
+        }
+      else
+        *d++ = *s++;
+    }
+  *d = 0;
+
+  return (d - d0);
+}
+
+
 /* Perform percent unescaping in STRING and return the new valid length
    of the string.  A terminating Nul character is inserted at the end of
    the unescaped string.
@@ -275,50 +520,62 @@ copy_and_escape (char *buffer, const void *text, size_t textlen)
 static size_t
 do_unescape_inplace (char *s)
 {
-  unsigned char *p, *p0;
+  return unescape_copy (s, s);
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+#ifndef O_DIRECTORY
+# define O_DIRECTORY 0
+#endif
+#ifndef O_CLOEXEC
+# define O_CLOEXEC 0
+#endif
+
+/* Read the file NAME in the directory DIRFD into BUFFER of SIZE and
+ * terminate it with a Nul.  At most SIZE-1 bytes are read.  Return
+ * the number of bytes read or -1 on error.  */
+static ssize_t
+read_proc_file (int dirfd, const char *name, char *buffer, size_t size)
+{
+  int fd;
+  size_t n = 0;
+  ssize_t nread;
 
-  p = p0 = s;
-  while (*s)
+  fd = openat (dirfd, name, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  while (n < size - 1)
     {
-      if (*s == '%' && s[1] && s[2])
+      nread = read (fd, buffer + n, size - 1 - n);
+      if (nread < 0 && errno == EINTR)
+        continue;
+      if (nread < 0)
         {
-          s++;
-          *p++ = xtoi_2 (s);
-          s += 2;
+          close (fd);
+          return -1;
         }
-      else
-        *p++ = *s++;
+      if (!nread)
+        break;
+      n += nread;
     }
-  *p = 0;
-
-  return (p - p0);
+  close (fd);
+  buffer[n] = 0;
+  return n;
 }
 
 
-/* Return a malloced copy of the commandline for PID.  If this is not
- * possible NULL is returned.  */
-#ifndef HAVE_W32_SYSTEM
+/* Return a malloced copy of the commandline of the process whose
+ * /proc directory is open at DIRFD.  If this is not possible NULL is
+ * returned.  */
 static char *
-get_cmdline (unsigned long pid)
+get_cmdline (int dirfd)
 {
   char buffer[200];
-  FILE *fp;
-  size_t i, n;
+  ssize_t i, n;
 
-  snprintf (buffer, sizeof buffer, "/proc/%lu/cmdline", pid);
-
-  fp = fopen (buffer, "rb");
-  if (!fp)
-    return NULL;
-  n = fread (buffer, 1, sizeof buffer - 1, fp);
-  if (n < sizeof buffer -1 && ferror (fp))
-    {
-      /* Some error occurred.  */
-      fclose (fp);
-      return NULL;
-    }
-  fclose (fp);
-  if (n == 0)
+  n = read_proc_file (dirfd, "cmdline", buffer, sizeof buffer);
+  if (n <= 0)
     return NULL;
   /* Arguments are delimited by Nuls.  We should do proper quoting but
    * that can be a bit complicated, thus we simply replace the Nuls by
@@ -326,46 +583,28 @@ get_cmdline (unsigned long pid)
   for (i=0; i < n; i++)
     if (!buffer[i] && i < n-1)
       buffer[i] = ' ';
-  buffer[i] = 0; /* Make sure the last byte is the string terminator.  */
 
   return strdup (buffer);
 }
-#endif /*!HAVE_W32_SYSTEM*/
 
 
-/* Atomically ask the kernel for information about process PID.
- * Return a malloc'ed copy of the process name as long as the process
- * uid matches UID.  If it cannot determine that the process has uid
- * UID, it returns NULL.
+/* Ask the kernel for information about the process whose /proc
+ * directory is open at DIRFD.  Return a malloc'ed copy of the process
+ * name as long as the process uid matches UID.  If it cannot
+ * determine that the process has uid UID, it returns NULL.
  *
  * This is not as informative as get_cmdline, but it verifies that the
  * process does belong to the user in question.
  */
-#ifndef HAVE_W32_SYSTEM
 static char *
-get_pid_name_for_uid (unsigned long pid, int uid)
+get_pid_name_for_uid (int dirfd, int uid)
 {
   char buffer[400];
-  FILE *fp;
-  size_t end, n;
+  size_t end;
   char *uidstr;
 
-  snprintf (buffer, sizeof buffer, "/proc/%lu/status", pid);
-
-  fp = fopen (buffer, "rb");
-  if (!fp)
-    return NULL;
-  n = fread (buffer, 1, sizeof buffer - 1, fp);
-  if (n < sizeof buffer -1 && ferror (fp))
-    {
-      /* Some error occurred.  */
-      fclose (fp);
-      return NULL;
-    }
-  fclose (fp);
-  if (n == 0)
+  if (read_proc_file (dirfd, "status", buffer, sizeof buffer) <= 0)
     return NULL;
-  buffer[n] = 0;
   /* Fixme: Is it specified that "Name" is always the first line?  For
    * robustness I would prefer to have a real parser here. -wk  */
   if (strncmp (buffer, "Name:\t", 6))
@@ -382,6 +621,59 @@ get_pid_name_for_uid (unsigned long pid, int uid)
 
   return strdup (buffer + 6);
 }
+
+
+/* The title describing the owner process.  It is computed on first
+ * use after OPTION owner, so that retries and later requests do not
+ * read /proc again.  */
+static struct
+{
+  int valid;
+  char text[200];
+} owner_title;
+
+
+/* Compute owner_title from the owner fields of PE.  Both /proc files
+ * are read through the same directory descriptor; if the PID is
+ * reused by another process in between, the second read fails instead
+ * of describing the wrong process.  */
+static void
+resolve_owner_title (pinentry_t pe)
+{
+  char path[50];
+  struct utsname utsbuf;
+  char *pidname = NULL;
+  char *cmdline = NULL;
+  int dirfd;
+
+  if (pe->owner_host &&
+      !uname (&utsbuf) &&
+      !strcmp (utsbuf.nodename, pe->owner_host))
+    {
+      snprintf (path, sizeof path, "/proc/%lu", pe->owner_pid);
+      dirfd = open (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (dirfd != -1)
+        {
+          pidname = get_pid_name_for_uid (dirfd, pe->owner_uid);
+          if (pidname)
+            cmdline = get_cmdline (dirfd);
+          close (dirfd);
+        }
+    }
+
+  if (pe->owner_host && (cmdline || pidname))
+    snprintf (owner_title.text, sizeof owner_title.text, "[%lu]@%s (%s)",
+              pe->owner_pid, pe->owner_host, cmdline ? cmdline : pidname);
+  else if (pe->owner_host)
+    snprintf (owner_title.text, sizeof owner_title.text, "[%lu]@%s",
+              pe->owner_pid, pe->owner_host);
+  else
+    snprintf (owner_title.text, sizeof owner_title.text,
+              "[%lu] <unknown host>", pe->owner_pid);
+  free (pidname);
+  free (cmdline);
+  owner_title.valid = 1;
+}
 #endif /*!HAVE_W32_SYSTEM*/
 
 
@@ -405,32 +697,9 @@ pinentry_get_title (pinentry_t pe)
 #ifndef HAVE_W32_SYSTEM
   else if (pe->owner_pid)
     {
-      char buf[200];
-      struct utsname utsbuf;
-      char *pidname = NULL;
-      char *cmdline = NULL;
-
-      if (pe->owner_host &&
-          !uname (&utsbuf) &&
-          !strcmp (utsbuf.nodename, pe->owner_host))
-        {
-          pidname = get_pid_name_for_uid (pe->owner_pid, pe->owner_uid);
-          if (pidname)
-            cmdline = get_cmdline (pe->owner_pid);
-        }
-
-      if (pe->owner_host && (cmdline || pidname))
-        snprintf (buf, sizeof buf, "[%lu]@%s (%s)",
-                  pe->owner_pid, pe->owner_host, cmdline ? cmdline : pidname);
-      else if (pe->owner_host)
-        snprintf (buf, sizeof buf, "[%lu]@%s",
-                  pe->owner_pid, pe->owner_host);
-      else
-        snprintf (buf, sizeof buf, "[%lu] <unknown host>",
-                  pe->owner_pid);
-      free (pidname);
-      free (cmdline);
-      title = strdup (buf);
+      if (!owner_title.valid)
+        resolve_owner_title (pe);
+      title = strdup (owner_title.text);
     }
 #endif /*!HAVE_W32_SYSTEM*/
   else
@@ -440,28 +709,32 @@ pinentry_get_title (pinentry_t pe)
 }
 
 
-/* Run a quality inquiry for PASSPHRASE of LENGTH.  (We need LENGTH
-   because not all backends might be able to return a proper
-   C-string.).  Returns: A value between -100 and 100 to give an
-   estimate of the passphrase's quality.  Negative values are use if
-   the caller won't even accept that passphrase.  Note that we expect
-   just one data line which should not be escaped in any represent a
-   numeric signed decimal value.  Extra data is currently ignored but
-   should not be send at all.  */
-int
-pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
+/* The file descriptor Assuan reads from, or -1.  */
+static int assuan_infd = -1;
+
+/* State of the inquiry started by inq_start.  Only one inquiry may
+   be outstanding at any time.  */
+static struct
+{
+  int pending;   /* Waiting for the END, CAN or ERR line.  */
+  char *value;   /* The first data line of the response or NULL.  */
+} inquiry;
+
+
+/* Send the inquiry PREFIX followed by the escaped PASSPHRASE of
+   LENGTH to the caller without waiting for the response.  */
+static gpg_error_t
+inq_start (pinentry_t pin, const char *prefix,
+           const char *passphrase, size_t length)
 {
   assuan_context_t ctx = pin->ctx_assuan;
-  const char prefix[] = "INQUIRE QUALITY ";
   char *command;
-  char *line;
-  size_t linelen;
-  int gotvalue = 0;
-  int value = 0;
   int rc;
 
   if (!ctx)
-    return 0; /* Can't run the callback.  */
+    return gpg_error (GPG_ERR_NOT_SUPPORTED); /* Can't run the callback.  */
+  if (inquiry.pending)
+    return gpg_error (GPG_ERR_EAGAIN);
 
   if (length > 300)
     length = 300;  /* Limit so that it definitely fits into an Assuan
@@ -469,7 +742,7 @@ pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
 
   command = secmem_malloc (strlen (prefix) + 3*length + 1);
   if (!command)
-    return 0;
+    return gpg_error_from_syserror ();
   strcpy (command, prefix);
   copy_and_escape (command + strlen(command), passphrase, length);
   rc = assuan_write_line (ctx, command);
@@ -477,21 +750,75 @@ pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
   if (rc)
     {
       fprintf (stderr, "ASSUAN WRITE LINE failed: rc=%d\n", rc);
-      return 0;
+      return rc;
     }
 
+  free (inquiry.value);
+  inquiry.value = NULL;
+  inquiry.pending = 1;
+  return 0;
+}
+
+
+/* Return true if a line can be read from Assuan without blocking.  */
+static int
+inq_readable (assuan_context_t ctx)
+{
+#ifndef HAVE_W32_SYSTEM
+  struct pollfd pfd;
+  int n;
+
+  if (assuan_pending_line (ctx) || assuan_infd == -1)
+    return 1;
+
+  pfd.fd = assuan_infd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  do
+    n = poll (&pfd, 1, 0);
+  while (n < 0 && errno == EINTR);
+  return n != 0;
+#else
+  (void)ctx;
+  return 1;
+#endif
+}
+
+
+int
+pinentry_inq_fd (pinentry_t pin)
+{
+  return pin->ctx_assuan ? assuan_infd : -1;
+}
+
+
+int
+pinentry_inq_poll (pinentry_t pin, int block)
+{
+  assuan_context_t ctx = pin->ctx_assuan;
+  char *line;
+  size_t linelen;
+  int rc;
+
+  if (!inquiry.pending)
+    return 1;
+
   for (;;)
     {
-      do
+      if (!block && !inq_readable (ctx))
+        return 0;
+
+      rc = assuan_read_line (ctx, &line, &linelen);
+      if (rc)
         {
-          rc = assuan_read_line (ctx, &line, &linelen);
-          if (rc)
-            {
-              fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
-              return 0;
-            }
+          fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
+          inquiry.pending = 0;
+          free (inquiry.value);
+          inquiry.value = NULL;
+          return -1;
         }
-      while (*line == '#' || !linelen);
+      if (*line == '#' || !linelen)
+        continue;
       if (line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
           && (!line[3] || line[3] == ' '))
         break; /* END command received*/
@@ -501,11 +828,46 @@ pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
       if (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
           && (!line[3] || line[3] == ' '))
         break; /* ERR command received*/
-      if (line[0] != 'D' || line[1] != ' ' || linelen < 3 || gotvalue)
+      if (line[0] != 'D' || line[1] != ' ' || linelen < 3 || inquiry.value)
         continue;
-      gotvalue = 1;
-      value = atoi (line+2);
+      inquiry.value = strdup (line + 2);
     }
+
+  inquiry.pending = 0;
+  return 1;
+}
+
+
+void
+pinentry_inq_abort (pinentry_t pin)
+{
+  /* An inquiry can't be cancelled; just discard the response.  */
+  pinentry_inq_poll (pin, 1);
+  free (inquiry.value);
+  inquiry.value = NULL;
+}
+
+
+gpg_error_t
+pinentry_inq_quality_start (pinentry_t pin,
+                            const char *passphrase, size_t length)
+{
+  return inq_start (pin, "INQUIRE QUALITY ", passphrase, length);
+}
+
+
+int
+pinentry_inq_quality_result (pinentry_t pin)
+{
+  int value = 0;
+
+  (void)pin;
+
+  if (inquiry.value)
+    value = atoi (inquiry.value);
+  free (inquiry.value);
+  inquiry.value = NULL;
+
   if (value < -100)
     value = -100;
   else if (value > 100)
@@ -515,70 +877,57 @@ pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
 }
 
 
-/* Run a checkpin inquiry */
-char *
-pinentry_inq_checkpin (pinentry_t pin, const char *passphrase, size_t length)
+/* Run a quality inquiry for PASSPHRASE of LENGTH.  (We need LENGTH
+   because not all backends might be able to return a proper
+   C-string.).  Returns: A value between -100 and 100 to give an
+   estimate of the passphrase's quality.  Negative values are use if
+   the caller won't even accept that passphrase.  Note that we expect
+   just one data line which should not be escaped in any represent a
+   numeric signed decimal value.  Extra data is currently ignored but
+   should not be send at all.  */
+int
+pinentry_inq_quality (pinentry_t pin, const char *passphrase, size_t length)
 {
-  assuan_context_t ctx = pin->ctx_assuan;
-  const char prefix[] = "INQUIRE CHECKPIN ";
-  char *command;
-  char *line;
-  size_t linelen;
-  int gotvalue = 0;
-  char *value = NULL;
-  int rc;
+  if (pinentry_inq_quality_start (pin, passphrase, length))
+    return 0;
+  if (pinentry_inq_poll (pin, 1) < 0)
+    return 0;
+  return pinentry_inq_quality_result (pin);
+}
 
-  if (!ctx)
-    return 0; /* Can't run the callback.  */
 
-  if (length > 300)
-    length = 300;  /* Limit so that it definitely fits into an Assuan
-                      line.  */
+gpg_error_t
+pinentry_inq_checkpin_start (pinentry_t pin,
+                             const char *passphrase, size_t length)
+{
+  return inq_start (pin, "INQUIRE CHECKPIN ", passphrase, length);
+}
 
-  command = secmem_malloc (strlen (prefix) + 3*length + 1);
-  if (!command)
-    return 0;
-  strcpy (command, prefix);
-  copy_and_escape (command + strlen(command), passphrase, length);
-  rc = assuan_write_line (ctx, command);
-  secmem_free (command);
-  if (rc)
-    {
-      fprintf (stderr, "ASSUAN WRITE LINE failed: rc=%d\n", rc);
-      return 0;
-    }
 
-  for (;;)
-    {
-      do
-        {
-          rc = assuan_read_line (ctx, &line, &linelen);
-          if (rc)
-            {
-              fprintf (stderr, "ASSUAN READ LINE failed: rc=%d\n", rc);
-              return 0;
-            }
-        }
-      while (*line == '#' || !linelen);
-      if (line[0] == 'E' && line[1] == 'N' && line[2] == 'D'
-          && (!line[3] || line[3] == ' '))
-        break; /* END command received*/
-      if (line[0] == 'C' && line[1] == 'A' && line[2] == 'N'
-          && (!line[3] || line[3] == ' '))
-        break; /* CAN command received*/
-      if (line[0] == 'E' && line[1] == 'R' && line[2] == 'R'
-          && (!line[3] || line[3] == ' '))
-        break; /* ERR command received*/
-      if (line[0] != 'D' || line[1] != ' ' || linelen < 3 || gotvalue)
-        continue;
-      gotvalue = 1;
-      value = strdup (line + 2);
-    }
+char *
+pinentry_inq_checkpin_result (pinentry_t pin)
+{
+  char *value = inquiry.value;
+
+  (void)pin;
 
+  inquiry.value = NULL;
   return value;
 }
 
 
+/* Run a checkpin inquiry */
+char *
+pinentry_inq_checkpin (pinentry_t pin, const char *passphrase, size_t length)
+{
+  if (pinentry_inq_checkpin_start (pin, passphrase, length))
+    return NULL;
+  if (pinentry_inq_poll (pin, 1) < 0)
+    return NULL;
+  return pinentry_inq_checkpin_result (pin);
+}
+
+
 /* Run a genpin inquiry */
 char *
 pinentry_inq_genpin (pinentry_t pin)
@@ -632,6 +981,71 @@ pinentry_inq_genpin (pinentry_t pin)
   return value;
 }
 
+/* Return a monotonic time in microseconds.  */
+static unsigned long long
+time_usec (void)
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+  return time (NULL) * 1000000ULL;
+}
+
+
+/* State of the heartbeat while the frontend's command handler runs.
+   The times are in microseconds of time_usec.  */
+static struct
+{
+  assuan_context_t ctx;        /* The context to write to or NULL.  */
+  unsigned long long start;    /* When the handler was called.  */
+  unsigned long long due;      /* When the next heartbeat is due.  */
+} heartbeat;
+
+
+int
+pinentry_heartbeat_interval (pinentry_t pin)
+{
+  if (!heartbeat.ctx || pin->heartbeat <= 0)
+    return 0;
+  return pin->heartbeat * 1000;
+}
+
+
+void
+pinentry_heartbeat (pinentry_t pin)
+{
+  char buf[50];
+  unsigned long long now, interval;
+
+  if (!heartbeat.ctx || pin->heartbeat <= 0)
+    return;
+  /* Do not interleave status lines with an outstanding asynchronous
+     inquiry.  Synchronous inquiries on another thread are the
+     frontend's business; see pinentry.h.  */
+  if (inquiry.pending)
+    return;
+
+  /* The timers of the event loops may fire a bit early, so accept
+     up to half an interval early.  The next beat is scheduled from
+     the due time, not from now, so that a frontend which calls this
+     more often still sends one beat per interval.  */
+  now = time_usec ();
+  interval = pin->heartbeat * 1000000ULL;
+  if (now + interval / 2 < heartbeat.due)
+    return;
+  heartbeat.due += interval;
+  if (heartbeat.due <= now)
+    heartbeat.due = now + interval;  /* Do not catch up after a stall.  */
+
+  snprintf (buf, sizeof buf, "heartbeat ? %lu 0",
+            (unsigned long)((now - heartbeat.start + 500000) / 1000000));
+  assuan_write_status (heartbeat.ctx, "PROGRESS", buf);
+}
+
+
 /* Try to make room for at least LEN bytes in the pinentry.  Returns
    new buffer on success and 0 on failure or when the old buffer is
    sufficient.  */
@@ -645,6 +1059,9 @@ pinentry_setbufferlen (pinentry_t pin, int len)
   else
     assert (!pin->pin);
 
+  /* The caller is about to store a new passphrase.  */
+  pin->pin_datalen = 0;
+
   if (len < 2048)
     len = 2048;
 
@@ -680,6 +1097,7 @@ pinentry_setbuffer_clear (pinentry_t pin)
   secmem_free (pin->pin);
   pin->pin = NULL;
   pin->pin_len = 0;
+  pin->pin_datalen = 0;
 }
 
 static void
@@ -689,10 +1107,25 @@ pinentry_setbuffer_init (pinentry_t pin)
   pinentry_setbufferlen (pin, 0);
 }
 
+char *
+pinentry_setbuffer_copy (pinentry_t pin, const char *passphrase,
+                         size_t length)
+{
+  if (length >= INT_MAX || !pinentry_setbufferlen (pin, length + 1))
+    return NULL;
+
+  memcpy (pin->pin, passphrase, length);
+  pin->pin[length] = 0;
+  pin->pin_datalen = length;
+  return pin->pin;
+}
+
 /* passphrase better be alloced with secmem_alloc.  */
 void
 pinentry_setbuffer_use (pinentry_t pin, char *passphrase, int len)
 {
+  int datalen = 0;
+
   if (! passphrase)
     {
       assert (len == 0);
@@ -702,13 +1135,17 @@ pinentry_setbuffer_use (pinentry_t pin, char *passphrase, int len)
     }
 
   if (passphrase && len == 0)
-    len = strlen (passphrase) + 1;
+    {
+      datalen = strlen (passphrase);
+      len = datalen + 1;
+    }
 
   if (pin->pin)
     secmem_free (pin->pin);
 
   pin->pin = passphrase;
   pin->pin_len = len;
+  pin->pin_datalen = datalen;
 }
 
 static struct assuan_malloc_hooks assuan_malloc_hooks = {
@@ -929,40 +1366,40 @@ pinentry_parse_opts (int argc, char *argv[])
 	case 'D':
           /* Note, this is currently not used because the GUI engine
              has already been initialized when parsing these options. */
-	  pinentry.display = strdup (pargs.r.ret_str);
-	  if (!pinentry.display)
+	  if (arena_set_string (&session_arena, &pinentry.display,
+                                pargs.r.ret_str, 0))
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'T':
-	  pinentry.ttyname = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttyname)
+	  if (arena_set_string (&session_arena, &pinentry.ttyname,
+                                pargs.r.ret_str, 0))
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'N':
-	  pinentry.ttytype_l = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttytype_l)
+	  if (arena_set_string (&session_arena, &pinentry.ttytype_l,
+                                pargs.r.ret_str, 0))
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'C':
-	  pinentry.lc_ctype = strdup (pargs.r.ret_str);
-	  if (!pinentry.lc_ctype)
+	  if (arena_set_string (&session_arena, &pinentry.lc_ctype,
+                                pargs.r.ret_str, 0))
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
 	    }
 	  break;
 	case 'M':
-	  pinentry.lc_messages = strdup (pargs.r.ret_str);
-	  if (!pinentry.lc_messages)
+	  if (arena_set_string (&session_arena, &pinentry.lc_messages,
+                                pargs.r.ret_str, 0))
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
@@ -993,8 +1430,8 @@ pinentry_parse_opts (int argc, char *argv[])
 	  break;
 
 	case 'a':
-	  pinentry.ttyalert = strdup (pargs.r.ret_str);
-	  if (!pinentry.ttyalert)
+	  if (arena_set_string (&session_arena, &pinentry.ttyalert,
+                                pargs.r.ret_str, 0))
 	    {
 	      fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
 	      exit (EXIT_FAILURE);
@@ -1009,275 +1446,355 @@ pinentry_parse_opts (int argc, char *argv[])
 
   if (!pinentry.display && remember_display)
     {
-      pinentry.display = remember_display;
+      if (arena_set_string (&session_arena, &pinentry.display,
+                            remember_display, 0))
+        {
+          fprintf (stderr, "%s: %s\n", this_pgmname, strerror (errno));
+          exit (EXIT_FAILURE);
+        }
+      free (remember_display);
       remember_display = NULL;
     }
 }
 
 
+/* The answers to GETINFO pid and flavor.  They do not change while
+   commands are processed and are thus computed in advance.  */
+static struct
+{
+  char pid[24];
+  size_t pidlen;
+  char flavor[100];
+  size_t flavorlen;
+} getinfo_answers;
+
+
+static void
+update_getinfo_answers (void)
+{
+  const char *s;
+
+  snprintf (getinfo_answers.pid, sizeof getinfo_answers.pid,
+            "%lu", (unsigned long)getpid ());
+  getinfo_answers.pidlen = strlen (getinfo_answers.pid);
+
+  if (!strncmp (this_pgmname, "pinentry-", 9) && this_pgmname[9])
+    s = this_pgmname + 9;
+  else
+    s = this_pgmname;
+  snprintf (getinfo_answers.flavor, sizeof getinfo_answers.flavor,
+            "%s%s%s",
+            s,
+            flavor_flag? ":":"",
+            flavor_flag? flavor_flag : "");
+  getinfo_answers.flavorlen = strlen (getinfo_answers.flavor);
+}
+
+
 /* Set the optional flag used with getinfo. */
 void
 pinentry_set_flavor_flag (const char *string)
 {
   flavor_flag = string;
+  update_getinfo_answers ();
 }
 
 
+/* Call HANDLER whenever no Assuan command has been received for
+   SECONDS seconds.  */
+void
+pinentry_set_idle_handler (pinentry_idle_handler_t handler, int seconds)
+{
+  idle_handler = handler;
+  idle_timeout = seconds;
+}
+
 
 
 static gpg_error_t
-option_handler (assuan_context_t ctx, const char *key, const char *value)
+option_debug_wait (const char *value)
 {
-  (void)ctx;
-
-  if (!strcmp (key, "no-grab") && !*value)
-    pinentry.grab = 0;
-  else if (!strcmp (key, "grab") && !*value)
-    pinentry.grab = 1;
-  else if (!strcmp (key, "debug-wait"))
-    {
 #ifndef HAVE_W32_SYSTEM
-      fprintf (stderr, "%s: waiting for debugger - my pid is %u ...\n",
-	       this_pgmname, (unsigned int) getpid());
-      sleep (*value?atoi (value):5);
-      fprintf (stderr, "%s: ... okay\n", this_pgmname);
+  fprintf (stderr, "%s: waiting for debugger - my pid is %u ...\n",
+           this_pgmname, (unsigned int) getpid());
+  sleep (*value?atoi (value):5);
+  fprintf (stderr, "%s: ... okay\n", this_pgmname);
+#else
+  (void)value;
 #endif
-    }
-  else if (!strcmp (key, "display"))
-    {
-      if (pinentry.display)
-	free (pinentry.display);
-      pinentry.display = strdup (value);
-      if (!pinentry.display)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "ttyname"))
-    {
-      if (pinentry.ttyname)
-	free (pinentry.ttyname);
-      pinentry.ttyname = strdup (value);
-      if (!pinentry.ttyname)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "ttytype"))
-    {
-      if (pinentry.ttytype_l)
-	free (pinentry.ttytype_l);
-      pinentry.ttytype_l = strdup (value);
-      if (!pinentry.ttytype_l)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "ttyalert"))
-    {
-      if (pinentry.ttyalert)
-	free (pinentry.ttyalert);
-      pinentry.ttyalert = strdup (value);
-      if (!pinentry.ttyalert)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "lc-ctype"))
-    {
-      if (pinentry.lc_ctype)
-	free (pinentry.lc_ctype);
-      pinentry.lc_ctype = strdup (value);
-      if (!pinentry.lc_ctype)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "lc-messages"))
-    {
-      if (pinentry.lc_messages)
-	free (pinentry.lc_messages);
-      pinentry.lc_messages = strdup (value);
-      if (!pinentry.lc_messages)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "owner"))
-    {
-      long along;
-      char *endp;
+  return 0;
+}
+
+
+static gpg_error_t
+option_owner (const char *value)
+{
+  long along;
+  char *endp;
 
-      free (pinentry.owner_host);
-      pinentry.owner_host = NULL;
-      pinentry.owner_uid = -1;
-      pinentry.owner_pid = 0;
+  arena_clear_string (&session_arena, &pinentry.owner_host);
+#ifndef HAVE_W32_SYSTEM
+  owner_title.valid = 0;
+#endif
+  pinentry.owner_uid = -1;
+  pinentry.owner_pid = 0;
 
-      errno = 0;
-      along = strtol (value, &endp, 10);
-      if (along && !errno)
+  errno = 0;
+  along = strtol (value, &endp, 10);
+  if (along && !errno)
+    {
+      pinentry.owner_pid = (unsigned long)along;
+      if (*endp)
         {
-          pinentry.owner_pid = (unsigned long)along;
-          if (*endp)
+          errno = 0;
+          if (*endp == '/') { /* we have a uid */
+            endp++;
+            along = strtol (endp, &endp, 10);
+            if (along >= 0 && !errno)
+              pinentry.owner_uid = (int)along;
+          }
+          if (endp)
             {
-              errno = 0;
-              if (*endp == '/') { /* we have a uid */
+              while (*endp == ' ')
                 endp++;
-                along = strtol (endp, &endp, 10);
-                if (along >= 0 && !errno)
-                  pinentry.owner_uid = (int)along;
-              }
-              if (endp)
+              if (*endp)
                 {
-                  while (*endp == ' ')
-                    endp++;
-                  if (*endp)
-                    {
-                      pinentry.owner_host = strdup (endp);
-                      for (endp=pinentry.owner_host;
-                           *endp && *endp != ' '; endp++)
-                        ;
-                      *endp = 0;
-                    }
+                  if (arena_set_string (&session_arena, &pinentry.owner_host,
+                                        endp, 0))
+                    return gpg_error_from_syserror ();
+                  for (endp=pinentry.owner_host;
+                       *endp && *endp != ' '; endp++)
+                    ;
+                  *endp = 0;
                 }
             }
         }
     }
-  else if (!strcmp (key, "parent-wid"))
-    {
-      pinentry.parent_wid = atoi (value);
-      /* FIXME: Use strtol and add some error handling.  */
-    }
-  else if (!strcmp (key, "touch-file"))
-    {
-      if (pinentry.touch_file)
-        free (pinentry.touch_file);
-      pinentry.touch_file = strdup (value);
-      if (!pinentry.touch_file)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-ok"))
-    {
-      pinentry.default_ok = strdup (value);
-      if (!pinentry.default_ok)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-cancel"))
-    {
-      pinentry.default_cancel = strdup (value);
-      if (!pinentry.default_cancel)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-prompt"))
-    {
-      pinentry.default_prompt = strdup (value);
-      if (!pinentry.default_prompt)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-pwmngr"))
-    {
-      pinentry.default_pwmngr = strdup (value);
-      if (!pinentry.default_pwmngr)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-cf-visi"))
-    {
-      pinentry.default_cf_visi = strdup (value);
-      if (!pinentry.default_cf_visi)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-tt-visi"))
-    {
-      pinentry.default_tt_visi = strdup (value);
-      if (!pinentry.default_tt_visi)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-tt-hide"))
-    {
-      pinentry.default_tt_hide = strdup (value);
-      if (!pinentry.default_tt_hide)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "default-capshint"))
-    {
-      pinentry.default_capshint = strdup (value);
-      if (!pinentry.default_capshint)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "allow-external-password-cache") && !*value)
-    {
-      char *desktop = getenv ("XDG_SESSION_DESKTOP");
-      char *kde_use_wallet = getenv ("PINENTRY_KDE_USE_WALLET");
-      pinentry.allow_external_password_cache = (!desktop || strcmp (desktop, "KDE") || (kde_use_wallet && *kde_use_wallet));
-      pinentry.tried_password_cache = 0;
-    }
-  else if (!strcmp (key, "allow-emacs-prompt") && !*value)
-    {
+  return 0;
+}
+
+
+static gpg_error_t
+option_allow_external_password_cache (const char *value)
+{
+  char *desktop = getenv ("XDG_SESSION_DESKTOP");
+  char *kde_use_wallet = getenv ("PINENTRY_KDE_USE_WALLET");
+
+  (void)value;
+
+  pinentry.allow_external_password_cache = (!desktop || strcmp (desktop, "KDE") || (kde_use_wallet && *kde_use_wallet));
+  pinentry.tried_password_cache = 0;
+  return 0;
+}
+
+
+static gpg_error_t
+option_allow_emacs_prompt (const char *value)
+{
+  (void)value;
 #ifdef INSIDE_EMACS
-      pinentry_enable_emacs_cmd_handler ();
+  pinentry_enable_emacs_cmd_handler ();
 #endif
-    }
-  else if (!strcmp (key, "invisible-char"))
-    {
-      if (pinentry.invisible_char)
-        free (pinentry.invisible_char);
-      pinentry.invisible_char = strdup (value);
-      if (!pinentry.invisible_char)
-	return gpg_error_from_syserror ();
-    }
-  else if (!strcmp (key, "formatted-passphrase") && !*value)
-    {
-      pinentry.formatted_passphrase = 1;
-    }
-  else if (!strcmp (key, "formatted-passphrase-hint"))
-    {
-      if (pinentry.formatted_passphrase_hint)
-        free (pinentry.formatted_passphrase_hint);
-      pinentry.formatted_passphrase_hint = strdup (value);
-      if (!pinentry.formatted_passphrase_hint)
-	return gpg_error_from_syserror ();
-      do_unescape_inplace(pinentry.formatted_passphrase_hint);
-    }
-  else if (!strcmp (key, "constraints-enforce") && !*value)
-    pinentry.constraints_enforce = 1;
-  else if (!strcmp (key, "constraints-hint-short"))
+  return 0;
+}
+
+
+/* How the value of an option is stored.  */
+enum option_type
+  {
+    OPT_STRING,      /* Replace an arena string.  */
+    OPT_STRING_UNESC,/* Likewise, but percent-unescape the value.  */
+    OPT_FLAG,        /* Set an int to FLAG_VALUE; takes no argument.  */
+    OPT_INT,         /* Set an int to the numeric value.  */
+    OPT_FUNC         /* Call FUNC with the value.  */
+  };
+
+/* Option flags.  */
+#define OPTF_NOVALUE 1  /* The option takes no argument.  */
+
+struct option_desc
+{
+  const char *name;
+  enum option_type type;
+  size_t offset;
+  size_t size;
+  unsigned int flags;
+  int flag_value;
+  gpg_error_t (*func) (const char *value);
+};
+
+/* All options known to option_handler.  This table must be sorted
+   by NAME in strcmp order; it is searched with bsearch.  Whether the
+   value survives RESET is decided by field_table.  */
+static const struct option_desc option_table[] =
+  {
+    { "allow-emacs-prompt", OPT_FUNC, PE_NOFIELD, OPTF_NOVALUE, 0,
+      option_allow_emacs_prompt },
+    { "allow-external-password-cache", OPT_FUNC, PE_NOFIELD, OPTF_NOVALUE, 0,
+      option_allow_external_password_cache },
+    { "constraints-enforce", OPT_FLAG, PE_FIELD (constraints_enforce), 0, 1 },
+    { "constraints-error-title", OPT_STRING_UNESC,
+      PE_FIELD (constraints_error_title) },
+    { "constraints-hint-long", OPT_STRING_UNESC,
+      PE_FIELD (constraints_hint_long) },
+    { "constraints-hint-short", OPT_STRING_UNESC,
+      PE_FIELD (constraints_hint_short) },
+    { "debug-wait", OPT_FUNC, PE_NOFIELD, 0, 0, option_debug_wait },
+    { "default-cancel", OPT_STRING, PE_FIELD (default_cancel) },
+    { "default-capshint", OPT_STRING, PE_FIELD (default_capshint) },
+    { "default-cf-visi", OPT_STRING, PE_FIELD (default_cf_visi) },
+    { "default-ok", OPT_STRING, PE_FIELD (default_ok) },
+    { "default-prompt", OPT_STRING, PE_FIELD (default_prompt) },
+    { "default-pwmngr", OPT_STRING, PE_FIELD (default_pwmngr) },
+    { "default-tt-hide", OPT_STRING, PE_FIELD (default_tt_hide) },
+    { "default-tt-visi", OPT_STRING, PE_FIELD (default_tt_visi) },
+    { "display", OPT_STRING, PE_FIELD (display) },
+    { "formatted-passphrase", OPT_FLAG, PE_FIELD (formatted_passphrase),
+      0, 1 },
+    { "formatted-passphrase-hint", OPT_STRING_UNESC,
+      PE_FIELD (formatted_passphrase_hint) },
+    { "grab", OPT_FLAG, PE_FIELD (grab), 0, 1 },
+    { "heartbeat", OPT_INT, PE_FIELD (heartbeat) },
+    { "invisible-char", OPT_STRING, PE_FIELD (invisible_char) },
+    { "lc-ctype", OPT_STRING, PE_FIELD (lc_ctype) },
+    { "lc-messages", OPT_STRING, PE_FIELD (lc_messages) },
+    { "no-grab", OPT_FLAG, PE_FIELD (grab), 0, 0 },
+    { "owner", OPT_FUNC, PE_NOFIELD, 0, 0, option_owner },
+    { "parent-wid", OPT_INT, PE_FIELD (parent_wid) },
+    { "touch-file", OPT_STRING, PE_FIELD (touch_file) },
+    { "ttyalert", OPT_STRING, PE_FIELD (ttyalert) },
+    { "ttyname", OPT_STRING, PE_FIELD (ttyname) },
+    { "ttytype", OPT_STRING, PE_FIELD (ttytype_l) }
+  };
+
+
+static int
+option_desc_cmp (const void *key, const void *elem)
+{
+  return strcmp (key, ((const struct option_desc *)elem)->name);
+}
+
+
+static gpg_error_t
+option_handler (assuan_context_t ctx, const char *key, const char *value)
+{
+  const struct option_desc *opt;
+  char *field;
+
+  (void)ctx;
+
+  opt = bsearch (key, option_table, DIM (option_table),
+                 sizeof *option_table, option_desc_cmp);
+  if (!opt)
+    return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+  if ((opt->type == OPT_FLAG || (opt->flags & OPTF_NOVALUE)) && *value)
+    return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+
+  field = (char *)&pinentry + opt->offset;
+  switch (opt->type)
     {
-      if (pinentry.constraints_hint_short)
-        free (pinentry.constraints_hint_short);
-      pinentry.constraints_hint_short = strdup (value);
-      if (!pinentry.constraints_hint_short)
-	return gpg_error_from_syserror ();
-      do_unescape_inplace(pinentry.constraints_hint_short);
+    case OPT_STRING:
+    case OPT_STRING_UNESC:
+      return arena_set_string ((field_desc_at (opt->offset)->policy
+                                == RESET_KEEP)
+                               ? &session_arena : &request_arena,
+                               (char **)field, value,
+                               opt->type == OPT_STRING_UNESC);
+
+    case OPT_FLAG:
+      *(int *)field = opt->flag_value;
+      touch_field (field);
+      break;
+
+    case OPT_INT:
+      /* FIXME: Use strtol and add some error handling.  */
+      *(int *)field = atoi (value);
+      touch_field (field);
+      break;
+
+    case OPT_FUNC:
+      return opt->func (value);
     }
-  else if (!strcmp (key, "constraints-hint-long"))
+  return 0;
+}
+
+
+static void
+pinentry_reset (int use_defaults)
+{
+  const struct field_desc *fd;
+  size_t i;
+
+  /* Give back the memory.  */
+  pinentry_setbuffer_clear (&pinentry);
+  free (pinentry.specific_err_info);
+  pinentry.specific_err_info = NULL;
+  arena_rewind (&request_arena);
+
+  if (use_defaults)
     {
-      if (pinentry.constraints_hint_long)
-        free (pinentry.constraints_hint_long);
-      pinentry.constraints_hint_long = strdup (value);
-      if (!pinentry.constraints_hint_long)
-	return gpg_error_from_syserror ();
-      do_unescape_inplace(pinentry.constraints_hint_long);
+      arena_rewind (&session_arena);
+#ifndef HAVE_W32_SYSTEM
+      owner_title.valid = 0;
+#endif
+      memset (&pinentry, 0, sizeof (pinentry));
+      for (i = 0; i < DIM (field_table); i++)
+        {
+          fd = field_table + i;
+          assert (!i || fd[-1].offset < fd->offset);
+          if (fd->defval)
+            {
+              assert (fd->size == sizeof (int));
+              *(int *)((char *)&pinentry + fd->offset) = fd->defval;
+            }
+        }
     }
-  else if (!strcmp (key, "constraints-error-title"))
+  else
     {
-      if (pinentry.constraints_error_title)
-        free (pinentry.constraints_error_title);
-      pinentry.constraints_error_title = strdup (value);
-      if (!pinentry.constraints_error_title)
-	return gpg_error_from_syserror ();
-      do_unescape_inplace(pinentry.constraints_error_title);
+      /* Only clear what was changed since the last reset.  The
+         fields marked RESET_KEEP, that is the options set once by GPG
+         Agent when it starts the pinentry and those set from the
+         command line, are not reset.  */
+      for (i = 0; i < field_dirty.count; i++)
+        {
+          fd = field_table + field_dirty.list[i];
+          if (fd->policy == RESET_CLEAR)
+            memset ((char *)&pinentry + fd->offset, 0, fd->size);
+        }
+      if (field_dirty.results)
+        for (i = 0; i < DIM (field_table); i++)
+          {
+            fd = field_table + i;
+            if (fd->policy == RESET_RESULT)
+              memset ((char *)&pinentry + fd->offset, 0, fd->size);
+          }
     }
-  else
-    return gpg_error (GPG_ERR_UNKNOWN_OPTION);
+
+  for (i = 0; i < field_dirty.count; i++)
+    field_dirty.flags[field_dirty.list[i]] = 0;
+  field_dirty.count = 0;
+  field_dirty.results = 0;
+}
+
+static gpg_error_t
+pinentry_assuan_reset_handler (assuan_context_t ctx, char *line)
+{
+  (void)ctx;
+  (void)line;
+
+  pinentry_reset (0);
+
   return 0;
 }
 
 
+
 /* Note, that it is sufficient to allocate the target string D as
    long as the source string S, i.e.: strlen(s)+1; */
 static void
 strcpy_escaped (char *d, const char *s)
 {
-  while (*s)
-    {
-      if (*s == '%' && s[1] && s[2])
-        {
-          s++;
-          *d++ = xtoi_2 ( s);
-          s += 2;
-        }
-      else
-        *d++ = *s++;
-    }
-  *d = 0;
+  unescape_copy (d, s);
 }
 
 
@@ -1305,38 +1822,18 @@ write_status_error (assuan_context_t ctx, pinentry_t pe)
 static gpg_error_t
 cmd_setdesc (assuan_context_t ctx, char *line)
 {
-  char *newd;
-
   (void)ctx;
 
-  newd = malloc (strlen (line) + 1);
-  if (!newd)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (newd, line);
-  if (pinentry.description)
-    free (pinentry.description);
-  pinentry.description = newd;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.description, line, 1);
 }
 
 
 static gpg_error_t
 cmd_setprompt (assuan_context_t ctx, char *line)
 {
-  char *newp;
-
   (void)ctx;
 
-  newp = malloc (strlen (line) + 1);
-  if (!newp)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (newp, line);
-  if (pinentry.prompt)
-    free (pinentry.prompt);
-  pinentry.prompt = newp;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.prompt, line, 1);
 }
 
 
@@ -1349,14 +1846,10 @@ cmd_setkeyinfo (assuan_context_t ctx, char *line)
 {
   (void)ctx;
 
-  if (pinentry.keyinfo)
-    free (pinentry.keyinfo);
-
   if (*line && strcmp(line, "--clear") != 0)
-    pinentry.keyinfo = strdup (line);
-  else
-    pinentry.keyinfo = NULL;
+    return arena_set_string (&request_arena, &pinentry.keyinfo, line, 0);
 
+  arena_clear_string (&request_arena, &pinentry.keyinfo);
   return 0;
 }
 
@@ -1364,129 +1857,62 @@ cmd_setkeyinfo (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_setrepeat (assuan_context_t ctx, char *line)
 {
-  char *p;
-
   (void)ctx;
 
-  p = malloc (strlen (line) + 1);
-  if (!p)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (p, line);
-  free (pinentry.repeat_passphrase);
-  pinentry.repeat_passphrase = p;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.repeat_passphrase, line, 1);
 }
 
 static gpg_error_t
 cmd_setrepeatok (assuan_context_t ctx, char *line)
 {
-  char *p;
-
   (void)ctx;
 
-  p = malloc (strlen (line) + 1);
-  if (!p)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (p, line);
-  free (pinentry.repeat_ok_string);
-  pinentry.repeat_ok_string = p;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.repeat_ok_string, line, 1);
 }
 
 
 static gpg_error_t
 cmd_setrepeaterror (assuan_context_t ctx, char *line)
 {
-  char *p;
-
   (void)ctx;
 
-  p = malloc (strlen (line) + 1);
-  if (!p)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (p, line);
-  free (pinentry.repeat_error_string);
-  pinentry.repeat_error_string = p;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.repeat_error_string, line, 1);
 }
 
 
 static gpg_error_t
 cmd_seterror (assuan_context_t ctx, char *line)
 {
-  char *newe;
-
   (void)ctx;
 
-  newe = malloc (strlen (line) + 1);
-  if (!newe)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (newe, line);
-  if (pinentry.error)
-    free (pinentry.error);
-  pinentry.error = newe;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.error, line, 1);
 }
 
 
 static gpg_error_t
 cmd_setok (assuan_context_t ctx, char *line)
 {
-  char *newo;
-
   (void)ctx;
 
-  newo = malloc (strlen (line) + 1);
-  if (!newo)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (newo, line);
-  if (pinentry.ok)
-    free (pinentry.ok);
-  pinentry.ok = newo;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.ok, line, 1);
 }
 
 
 static gpg_error_t
 cmd_setnotok (assuan_context_t ctx, char *line)
 {
-  char *newo;
-
   (void)ctx;
 
-  newo = malloc (strlen (line) + 1);
-  if (!newo)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (newo, line);
-  if (pinentry.notok)
-    free (pinentry.notok);
-  pinentry.notok = newo;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.notok, line, 1);
 }
 
 
 static gpg_error_t
 cmd_setcancel (assuan_context_t ctx, char *line)
 {
-  char *newc;
-
   (void)ctx;
 
-  newc = malloc (strlen (line) + 1);
-  if (!newc)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (newc, line);
-  if (pinentry.cancel)
-    free (pinentry.cancel);
-  pinentry.cancel = newc;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.cancel, line, 1);
 }
 
 
@@ -1504,114 +1930,80 @@ cmd_settimeout (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_settitle (assuan_context_t ctx, char *line)
 {
-  char *newt;
-
   (void)ctx;
 
-  newt = malloc (strlen (line) + 1);
-  if (!newt)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (newt, line);
-  if (pinentry.title)
-    free (pinentry.title);
-  pinentry.title = newt;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.title, line, 1);
 }
 
 static gpg_error_t
 cmd_setqualitybar (assuan_context_t ctx, char *line)
 {
-  char *newval;
-
   (void)ctx;
 
   if (!*line)
     line = "Quality:";
 
-  newval = malloc (strlen (line) + 1);
-  if (!newval)
-    return gpg_error_from_syserror ();
-
-  strcpy_escaped (newval, line);
-  if (pinentry.quality_bar)
-    free (pinentry.quality_bar);
-  pinentry.quality_bar = newval;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.quality_bar, line, 1);
 }
 
 /* Set the tooltip to be used for a quality bar.  */
 static gpg_error_t
 cmd_setqualitybar_tt (assuan_context_t ctx, char *line)
 {
-  char *newval;
-
   (void)ctx;
 
-  if (*line)
+  if (!*line)
     {
-      newval = malloc (strlen (line) + 1);
-      if (!newval)
-        return gpg_error_from_syserror ();
-
-      strcpy_escaped (newval, line);
+      arena_clear_string (&request_arena, &pinentry.quality_bar_tt);
+      return 0;
     }
-  else
-    newval = NULL;
-  if (pinentry.quality_bar_tt)
-    free (pinentry.quality_bar_tt);
-  pinentry.quality_bar_tt = newval;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.quality_bar_tt, line, 1);
 }
 
 /* Set the tooltip to be used for a generate action.  */
 static gpg_error_t
 cmd_setgenpin_tt (assuan_context_t ctx, char *line)
 {
-  char *newval;
-
   (void)ctx;
 
-  if (*line)
+  if (!*line)
     {
-      newval = malloc (strlen (line) + 1);
-      if (!newval)
-        return gpg_error_from_syserror ();
-
-      strcpy_escaped (newval, line);
+      arena_clear_string (&request_arena, &pinentry.genpin_tt);
+      return 0;
     }
-  else
-    newval = NULL;
-  if (pinentry.genpin_tt)
-    free (pinentry.genpin_tt);
-  pinentry.genpin_tt = newval;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.genpin_tt, line, 1);
 }
 
 /* Set the label to be used for a generate action.  */
 static gpg_error_t
 cmd_setgenpin_label (assuan_context_t ctx, char *line)
 {
-  char *newval;
-
   (void)ctx;
 
-  if (*line)
+  if (!*line)
     {
-      newval = malloc (strlen (line) + 1);
-      if (!newval)
-        return gpg_error_from_syserror ();
-
-      strcpy_escaped (newval, line);
+      arena_clear_string (&request_arena, &pinentry.genpin_label);
+      return 0;
     }
-  else
-    newval = NULL;
-  if (pinentry.genpin_label)
-    free (pinentry.genpin_label);
-  pinentry.genpin_label = newval;
-  return 0;
+  return arena_set_string (&request_arena, &pinentry.genpin_label, line, 1);
+}
+
+/* Call the frontend's command handler for the request on CTX and
+   allow it to send heartbeats meanwhile.  */
+static int
+run_cmd_handler (assuan_context_t ctx)
+{
+  int result;
+
+  heartbeat.ctx = ctx;
+  heartbeat.start = time_usec ();
+  heartbeat.due = heartbeat.start + pinentry.heartbeat * 1000000ULL;
+  result = (*pinentry_cmd_handler) (&pinentry);
+  heartbeat.ctx = NULL;
+  return result;
 }
 
+
 static gpg_error_t
 cmd_getpin (assuan_context_t ctx, char *line)
 {
@@ -1621,6 +2013,7 @@ cmd_getpin (assuan_context_t ctx, char *line)
 
   (void)line;
 
+  field_dirty.results = 1;
   pinentry_setbuffer_init (&pinentry);
   if (!pinentry.pin)
     return gpg_error (GPG_ERR_ENOMEM);
@@ -1652,14 +2045,9 @@ cmd_getpin (assuan_context_t ctx, char *line)
       if (password)
 	/* There is a cached password.  Try it.  */
 	{
-	  int len = strlen(password) + 1;
-	  if (len > pinentry.pin_len)
-	    len = pinentry.pin_len;
-
-	  memcpy (pinentry.pin, password, len);
-	  pinentry.pin[len] = '\0';
-
-	  secmem_free (password);
+	  /* The password is already in secure memory; take it over
+	     instead of copying it.  */
+	  pinentry_setbuffer_use (&pinentry, password, 0);
 
 	  pinentry.pin_from_cache = 1;
 
@@ -1667,7 +2055,7 @@ cmd_getpin (assuan_context_t ctx, char *line)
 
 	  /* Result is the length of the password not including the
 	     NUL terminator.  */
-	  result = len - 1;
+	  result = pinentry.pin_datalen;
 
 	  just_read_password_from_cache = 1;
 
@@ -1693,18 +2081,10 @@ cmd_getpin (assuan_context_t ctx, char *line)
   pinentry.repeat_okay = 0;
   pinentry.one_button = 0;
   pinentry.ctx_assuan = ctx;
-  result = (*pinentry_cmd_handler) (&pinentry);
+  result = run_cmd_handler (ctx);
   pinentry.ctx_assuan = NULL;
-  if (pinentry.error)
-    {
-      free (pinentry.error);
-      pinentry.error = NULL;
-    }
-  if (pinentry.repeat_passphrase)
-    {
-      free (pinentry.repeat_passphrase);
-      pinentry.repeat_passphrase = NULL;
-    }
+  arena_clear_string (&request_arena, &pinentry.error);
+  arena_clear_string (&request_arena, &pinentry.repeat_passphrase);
   if (set_prompt)
     pinentry.prompt = NULL;
 
@@ -1736,7 +2116,10 @@ cmd_getpin (assuan_context_t ctx, char *line)
       if (pinentry.repeat_okay)
         assuan_write_status (ctx, "PIN_REPEATED", "");
       assuan_begin_confidential (ctx);
-      result = assuan_send_data (ctx, pinentry.pin, strlen(pinentry.pin));
+      result = assuan_send_data (ctx, pinentry.pin,
+                                 (pinentry.pin_datalen
+                                  ? pinentry.pin_datalen
+                                  : strlen (pinentry.pin)));
       if (!result)
 	result = assuan_send_data (ctx, NULL, 0);
       assuan_end_confidential (ctx);
@@ -1769,6 +2152,7 @@ cmd_confirm (assuan_context_t ctx, char *line)
 {
   int result;
 
+  field_dirty.results = 1;
   pinentry.one_button = !!strstr (line, "--one-button");
   pinentry.quality_bar = 0;
   pinentry.close_button = 0;
@@ -1780,12 +2164,8 @@ cmd_confirm (assuan_context_t ctx, char *line)
   pinentry.canceled = 0;
   pinentry.confirm = 1;
   pinentry_setbuffer_clear (&pinentry);
-  result = (*pinentry_cmd_handler) (&pinentry);
-  if (pinentry.error)
-    {
-      free (pinentry.error);
-      pinentry.error = NULL;
-    }
+  result = run_cmd_handler (ctx);
+  arena_clear_string (&request_arena, &pinentry.error);
 
   if (pinentry.close_button)
     assuan_write_status (ctx, "BUTTON_INFO", "close");
@@ -1826,23 +2206,32 @@ cmd_message (assuan_context_t ctx, char *line)
 
 /* Return a staically allocated string with information on the mode,
  * uid, and gid of DEVICE.  On error "?" is returned if DEVICE is
- * NULL, "-" is returned.  */
+ * NULL, "-" is returned.  The result for the last DEVICE is cached
+ * because GETINFO ttyinfo is polled; it is only looked up again once
+ * the device name changes.  */
 static const char *
 device_stat_string (const char *device)
 {
 #ifdef HAVE_STAT
   static char buf[40];
+  static char *cached_device;
   struct stat st;
 
   if (!device || !*device)
     return "-";
 
+  if (cached_device && !strcmp (cached_device, device))
+    return buf;
+  free (cached_device);
+  cached_device = NULL;
+
   if (stat (device, &st))
     return "?";  /* Error */
   snprintf (buf, sizeof buf, "%lo/%lu/%lu",
             (unsigned long)st.st_mode,
             (unsigned long)st.st_uid,
             (unsigned long)st.st_gid);
+  cached_device = strdup (device);
   return buf;
 #else
   return "-";
@@ -1850,6 +2239,95 @@ device_stat_string (const char *device)
 }
 
 
+/* Usage statistics of the Assuan commands for GETINFO stats.  */
+#define MAX_CMD_STATS 32
+
+static struct cmd_stats
+{
+  char name[24];
+  unsigned long count;
+  unsigned long long total_us;  /* Summed up run time.  */
+  unsigned long long max_us;    /* Longest run time.  */
+} cmd_stats[MAX_CMD_STATS];
+
+/* The entry of the command being processed and its start time.  */
+static struct cmd_stats *current_cmd_stats;
+static unsigned long long current_cmd_start;
+
+
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  int i;
+
+  (void)ctx;
+
+  current_cmd_stats = NULL;
+  for (i = 0; i < MAX_CMD_STATS && *cmd_stats[i].name; i++)
+    if (!strcmp (cmd_stats[i].name, cmd))
+      break;
+  if (i == MAX_CMD_STATS)
+    return 0;  /* Table full; do not count.  */
+  if (!*cmd_stats[i].name)
+    snprintf (cmd_stats[i].name, sizeof cmd_stats[i].name, "%s", cmd);
+
+  current_cmd_stats = cmd_stats + i;
+  current_cmd_start = time_usec ();
+  return 0;
+}
+
+
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  unsigned long long elapsed;
+
+  (void)ctx;
+  (void)err;
+
+  if (!current_cmd_stats)
+    return;
+
+  elapsed = time_usec () - current_cmd_start;
+  current_cmd_stats->count++;
+  current_cmd_stats->total_us += elapsed;
+  if (elapsed > current_cmd_stats->max_us)
+    current_cmd_stats->max_us = elapsed;
+  current_cmd_stats = NULL;
+}
+
+
+/* Send the statistics for GETINFO stats.  Each line describes one
+   command or the secure memory.  */
+static gpg_error_t
+send_stats (assuan_context_t ctx)
+{
+  struct secmem_stats sm;
+  char buffer[150];
+  int i;
+  gpg_error_t rc = 0;
+
+  for (i = 0; !rc && i < MAX_CMD_STATS && *cmd_stats[i].name; i++)
+    {
+      snprintf (buffer, sizeof buffer,
+                "%s count=%lu total_us=%llu max_us=%llu\n",
+                cmd_stats[i].name, cmd_stats[i].count,
+                cmd_stats[i].total_us, cmd_stats[i].max_us);
+      rc = assuan_send_data (ctx, buffer, strlen (buffer));
+    }
+  if (rc)
+    return rc;
+
+  secmem_get_stats (&sm);
+  snprintf (buffer, sizeof buffer,
+            "secmem bytes=%lu/%lu blocks=%u/%u allocs=%lu pool=%lu/%lu",
+            (unsigned long)sm.cur_alloced, (unsigned long)sm.max_alloced,
+            sm.cur_blocks, sm.max_blocks, sm.total_blocks,
+            (unsigned long)sm.poollen, (unsigned long)sm.poolsize);
+  return assuan_send_data (ctx, buffer, strlen (buffer));
+}
+
+
 /* GETINFO <what>
 
    Multipurpose function to return a variety of information.
@@ -1859,37 +2337,23 @@ device_stat_string (const char *device)
      pid         - Return the process id of the server.
      flavor      - Return information about the used pinentry flavor
      ttyinfo     - Return DISPLAY, ttyinfo and an emacs pinentry status
+     stats       - Return the count and run time of the commands
+                   processed so far and the secure memory usage
  */
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
   int rc;
-  const char *s;
   char buffer[150];
 
   if (!strcmp (line, "version"))
-    {
-      s = VERSION;
-      rc = assuan_send_data (ctx, s, strlen (s));
-    }
+    rc = assuan_send_data (ctx, VERSION, sizeof VERSION - 1);
   else if (!strcmp (line, "pid"))
-    {
-
-      snprintf (buffer, sizeof buffer, "%lu", (unsigned long)getpid ());
-      rc = assuan_send_data (ctx, buffer, strlen (buffer));
-    }
+    rc = assuan_send_data (ctx, getinfo_answers.pid, getinfo_answers.pidlen);
   else if (!strcmp (line, "flavor"))
     {
-      if (!strncmp (this_pgmname, "pinentry-", 9) && this_pgmname[9])
-        s = this_pgmname + 9;
-      else
-        s = this_pgmname;
-
-      snprintf (buffer, sizeof buffer, "%s%s%s",
-                s,
-                flavor_flag? ":":"",
-                flavor_flag? flavor_flag : "");
-      rc = assuan_send_data (ctx, buffer, strlen (buffer));
+      rc = assuan_send_data (ctx, getinfo_answers.flavor,
+                             getinfo_answers.flavorlen);
       /* if (!rc) */
       /*   rc = assuan_write_status (ctx, "FEATURES", "tabbing foo bar"); */
     }
@@ -1916,6 +2380,8 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 );
       rc = assuan_send_data (ctx, buffer, strlen (buffer));
     }
+  else if (!strcmp (line, "stats"))
+    rc = send_stats (ctx);
   else
     rc = gpg_error (GPG_ERR_ASS_PARAMETER);
   return rc;
@@ -1948,45 +2414,257 @@ cmd_clear_passphrase (assuan_context_t ctx, char *line)
     }
 }
 
+/* Wait for the next command on FD.  If none arrives within the idle
+   timeout, run the idle handler; reading the command is then left to
+   Assuan.  */
+static void
+wait_for_command (assuan_context_t ctx, int fd)
+{
+#ifndef HAVE_W32_SYSTEM
+  struct pollfd pfd;
+  int n;
+
+  if (!idle_handler || assuan_pending_line (ctx))
+    return;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  do
+    n = poll (&pfd, 1, idle_timeout * 1000);
+  while (n < 0 && errno == EINTR);
+
+  if (!n)
+    (*idle_handler) ();
+#else
+  (void)ctx;
+  (void)fd;
+#endif
+}
+
+
+/* Flags for command_table.  */
+#define CMDF_BATCH 1  /* The command may be given to SETALL.  */
+
+/* The command loop runs the commands with assuan_process_next, which,
+   unlike assuan_process, leaves sending the final OK or ERR to the
+   command handler.  COMMAND_DONE (HANDLER) defines HANDLER_done,
+   which runs HANDLER and sends its result.  */
+#define COMMAND_DONE(handler)                                   \
+  static gpg_error_t                                            \
+  handler ## _done (assuan_context_t ctx, char *line)           \
+  {                                                             \
+    return assuan_process_done (ctx, handler (ctx, line));      \
+  }
+
+COMMAND_DONE (cmd_setdesc)
+COMMAND_DONE (cmd_setprompt)
+COMMAND_DONE (cmd_setkeyinfo)
+COMMAND_DONE (cmd_setrepeat)
+COMMAND_DONE (cmd_setrepeaterror)
+COMMAND_DONE (cmd_setrepeatok)
+COMMAND_DONE (cmd_seterror)
+COMMAND_DONE (cmd_setok)
+COMMAND_DONE (cmd_setnotok)
+COMMAND_DONE (cmd_setcancel)
+COMMAND_DONE (cmd_getpin)
+COMMAND_DONE (cmd_confirm)
+COMMAND_DONE (cmd_message)
+COMMAND_DONE (cmd_setqualitybar)
+COMMAND_DONE (cmd_setqualitybar_tt)
+COMMAND_DONE (cmd_setgenpin_label)
+COMMAND_DONE (cmd_setgenpin_tt)
+COMMAND_DONE (cmd_getinfo)
+COMMAND_DONE (cmd_settitle)
+COMMAND_DONE (cmd_settimeout)
+COMMAND_DONE (cmd_clear_passphrase)
+
+static gpg_error_t cmd_setall (assuan_context_t ctx, char *line);
+COMMAND_DONE (cmd_setall)
+
+/* An entry of command_table for NAME run by HANDLER.  */
+#define COMMAND(name, handler, flags) \
+  { name, handler, handler ## _done, flags }
+
+static const struct
+{
+  const char *name;
+  gpg_error_t (*handler) (assuan_context_t, char *line);
+  gpg_error_t (*handler_done) (assuan_context_t, char *line); /* For Assuan.  */
+  unsigned int flags;
+} command_table[] =
+  {
+    COMMAND ("SETDESC", cmd_setdesc, CMDF_BATCH),
+    COMMAND ("SETPROMPT", cmd_setprompt, CMDF_BATCH),
+    COMMAND ("SETKEYINFO", cmd_setkeyinfo, CMDF_BATCH),
+    COMMAND ("SETREPEAT", cmd_setrepeat, CMDF_BATCH),
+    COMMAND ("SETREPEATERROR", cmd_setrepeaterror, CMDF_BATCH),
+    COMMAND ("SETREPEATOK", cmd_setrepeatok, CMDF_BATCH),
+    COMMAND ("SETERROR", cmd_seterror, CMDF_BATCH),
+    COMMAND ("SETOK", cmd_setok, CMDF_BATCH),
+    COMMAND ("SETNOTOK", cmd_setnotok, CMDF_BATCH),
+    COMMAND ("SETCANCEL", cmd_setcancel, CMDF_BATCH),
+    COMMAND ("GETPIN", cmd_getpin, 0),
+    COMMAND ("CONFIRM", cmd_confirm, 0),
+    COMMAND ("MESSAGE", cmd_message, 0),
+    COMMAND ("SETQUALITYBAR", cmd_setqualitybar, CMDF_BATCH),
+    COMMAND ("SETQUALITYBAR_TT", cmd_setqualitybar_tt, CMDF_BATCH),
+    COMMAND ("SETGENPIN", cmd_setgenpin_label, CMDF_BATCH),
+    COMMAND ("SETGENPIN_TT", cmd_setgenpin_tt, CMDF_BATCH),
+    COMMAND ("GETINFO", cmd_getinfo, 0),
+    COMMAND ("SETTITLE", cmd_settitle, CMDF_BATCH),
+    COMMAND ("SETTIMEOUT", cmd_settimeout, CMDF_BATCH),
+    COMMAND ("CLEARPASSPHRASE", cmd_clear_passphrase, 0),
+    COMMAND ("SETALL", cmd_setall, 0)
+  };
+
+
+/* Run the OPTION line LINE given to SETALL.  This parses the line
+   like the OPTION handler of libassuan does.  */
+static gpg_error_t
+setall_option (assuan_context_t ctx, char *line)
+{
+  char *key, *value, *p;
+
+  for (key = line; *key == ' ' || *key == '\t'; key++)
+    ;
+  if (!*key || *key == '=')
+    return gpg_error (GPG_ERR_ASS_SYNTAX);
+  for (value = key; *value && *value != ' ' && *value != '\t'
+         && *value != '='; value++)
+    ;
+  if (*value)
+    {
+      if (*value != '=')
+        *value++ = 0;  /* Terminate the key.  */
+      for (; *value == ' ' || *value == '\t'; value++)
+        ;
+      if (*value == '=')
+        {
+          *value++ = 0;  /* Terminate the key.  */
+          for (; *value == ' ' || *value == '\t'; value++)
+            ;
+          if (!*value)
+            return gpg_error (GPG_ERR_ASS_PARAMETER);
+        }
+      if (*value)
+        {
+          /* Strip trailing spaces.  */
+          for (p = value + strlen (value) - 1;
+               p > value && (*p == ' ' || *p == '\t'); p--)
+            ;
+          p[1] = 0;
+        }
+    }
+  if (key[0] == '-' && key[1] == '-' && key[2])
+    key += 2;
+
+  return option_handler (ctx, key, value);
+}
+
+
+/* The maximum size of a SETALL list sent as data.  Assuan allocates
+   the whole buffer up front from the secure memory pool, which is
+   only 16k, so keep this well below that.  */
+#define SETALL_MAXLEN 4096
+
+/* Run the linefeed separated command lines of LIST for SETALL.  */
+static gpg_error_t
+setall_run (assuan_context_t ctx, char *list)
+{
+  char *p, *next, *args;
+  gpg_error_t rc = 0;
+  size_t i;
+
+  for (p = list; p && !rc; p = next)
+    {
+      next = strchr (p, '\n');
+      if (next)
+        *next++ = 0;
+      if (!*p)
+        continue;
+
+      args = p + strcspn (p, " ");
+      if (*args)
+        *args++ = 0;
+      while (*args == ' ')
+        args++;
+
+      if (!strcmp (p, "OPTION"))
+        {
+          rc = setall_option (ctx, args);
+          continue;
+        }
+      for (i = 0; i < DIM (command_table); i++)
+        if (!strcmp (p, command_table[i].name))
+          break;
+      if (i == DIM (command_table)
+          || !(command_table[i].flags & CMDF_BATCH))
+        rc = gpg_error (GPG_ERR_ASS_UNKNOWN_CMD);
+      else
+        rc = command_table[i].handler (ctx, args);
+    }
+  return rc;
+}
+
+
+/* SETALL [<lines>]
+
+   Run several SET commands and OPTIONs at once to save round trips.
+   The argument is a percent-escaped list of command lines separated
+   by linefeeds; each of them is percent-escaped itself as if it were
+   sent on its own.  The commands are run in order until one of them
+   fails; its error is returned and the commands before it stay in
+   effect.  Only commands which just set a value are allowed here.
+
+   Like any Assuan line, the argument is limited to about 1000 bytes.
+   Without an argument the list is inquired with "INQUIRE SETALL"
+   instead and may be up to SETALL_MAXLEN bytes; a longer list is
+   rejected with GPG_ERR_ASS_TOO_MUCH_DATA.  */
+static gpg_error_t
+cmd_setall (assuan_context_t ctx, char *line)
+{
+  unsigned char *data;
+  size_t datalen;
+  char *list;
+  gpg_error_t rc;
+
+  if (*line)
+    {
+      do_unescape_inplace (line);
+      return setall_run (ctx, line);
+    }
+
+  rc = assuan_inquire (ctx, "SETALL", &data, &datalen, SETALL_MAXLEN);
+  if (rc)
+    return rc;
+  list = malloc (datalen + 1);
+  if (!list)
+    rc = gpg_error_from_syserror ();
+  else
+    {
+      memcpy (list, data, datalen);
+      list[datalen] = 0;
+      rc = setall_run (ctx, list);
+      free (list);
+    }
+  /* Allocated by Assuan through our malloc hooks.  */
+  secmem_free (data);
+  return rc;
+}
+
+
 /* Tell the assuan library about our commands.  */
 static gpg_error_t
 register_commands (assuan_context_t ctx)
 {
-  static struct
-  {
-    const char *name;
-    gpg_error_t (*handler) (assuan_context_t, char *line);
-  } table[] =
-    {
-      { "SETDESC",    cmd_setdesc },
-      { "SETPROMPT",  cmd_setprompt },
-      { "SETKEYINFO", cmd_setkeyinfo },
-      { "SETREPEAT",  cmd_setrepeat },
-      { "SETREPEATERROR", cmd_setrepeaterror },
-      { "SETREPEATOK", cmd_setrepeatok},
-      { "SETERROR",   cmd_seterror },
-      { "SETOK",      cmd_setok },
-      { "SETNOTOK",   cmd_setnotok },
-      { "SETCANCEL",  cmd_setcancel },
-      { "GETPIN",     cmd_getpin },
-      { "CONFIRM",    cmd_confirm },
-      { "MESSAGE",    cmd_message },
-      { "SETQUALITYBAR", cmd_setqualitybar },
-      { "SETQUALITYBAR_TT", cmd_setqualitybar_tt },
-      { "SETGENPIN",    cmd_setgenpin_label },
-      { "SETGENPIN_TT", cmd_setgenpin_tt },
-      { "GETINFO",    cmd_getinfo },
-      { "SETTITLE",   cmd_settitle },
-      { "SETTIMEOUT", cmd_settimeout },
-      { "CLEARPASSPHRASE", cmd_clear_passphrase },
-      { NULL }
-    };
-  int i, j;
+  size_t i;
   gpg_error_t rc;
 
-  for (i = j = 0; table[i].name; i++)
+  for (i = 0; i < DIM (command_table); i++)
     {
-      rc = assuan_register_command (ctx, table[i].name, table[i].handler, NULL);
+      rc = assuan_register_command (ctx, command_table[i].name,
+                                    command_table[i].handler_done, NULL);
       if (rc)
         return rc;
     }
@@ -2018,6 +2696,7 @@ pinentry_loop2 (int infd, int outfd)
   /* For now we use a simple pipe based server so that we can work
      from scripts.  We will later add options to run as a daemon and
      wait for requests on a Unix domain socket.  */
+  assuan_infd = infd;
   filedes[0] = assuan_fdopen (infd);
   filedes[1] = assuan_fdopen (outfd);
   rc = assuan_init_pipe_server (ctx, filedes);
@@ -2040,6 +2719,9 @@ pinentry_loop2 (int infd, int outfd)
   assuan_set_log_stream (ctx, stderr);
 #endif
   assuan_register_reset_notify (ctx, pinentry_assuan_reset_handler);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
+  update_getinfo_answers ();
 
   for (;;)
     {
@@ -2053,7 +2735,16 @@ pinentry_loop2 (int infd, int outfd)
           break;
         }
 
-      rc = assuan_process (ctx);
+      do
+        {
+          int done = 0;
+
+          wait_for_command (ctx, infd);
+          rc = assuan_process_next (ctx, &done);
+          if (done)
+            break;
+        }
+      while (!rc);
       if (rc)
         {
           fprintf (stderr, "%s: Assuan processing failed: %s\n",
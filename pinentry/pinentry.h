@@ -38,6 +38,9 @@ typedef enum {
   PINENTRY_COLOR_CYAN, PINENTRY_COLOR_WHITE
 } pinentry_color_t;
 
+/* The string members of this structure are owned by the pinentry
+   core.  They are carved from string arenas which are rewound by
+   RESET; a frontend must neither free nor realloc them.  */
 struct pinentry
 {
   /* The window title, or NULL.  (Assuan: "SETTITLE TITLE".)  */
@@ -66,6 +69,11 @@ struct pinentry
   char *pin;
   /* The length of the buffer.  */
   int pin_len;
+  /* The length of the passphrase in PIN without the terminating Nul.
+     A frontend which knows it should set it after filling PIN (or use
+     pinentry_setbuffer_copy).  0 means "unknown, use strlen"; for an
+     empty passphrase both give the same result.  */
+  int pin_datalen;
   /* Whether the pin was read from an external cache (1) or entered by
      the user (0). */
   int pin_from_cache;
@@ -97,6 +105,11 @@ struct pinentry
      or "OPTION no-grab".)  */
   int grab;
 
+  /* The number of seconds between two heartbeat status lines sent
+     while a prompt is shown, or 0 to send none.  (Assuan: "OPTION
+     heartbeat=SECONDS".)  */
+  int heartbeat;
+
   /* The PID of the owner or 0 if not known.  The owner is the process
    * which actually triggered the the pinentry.  For example gpg.  */
   unsigned long owner_pid;
@@ -105,7 +118,7 @@ struct pinentry
    * known. */
   int owner_uid;
 
-  /* The malloced hostname of the owner or NULL.  */
+  /* The hostname of the owner or NULL.  */
   char *owner_host;
 
   /* The window ID of the parent window over which the pinentry window
@@ -179,17 +192,17 @@ struct pinentry
      "SETQUALITYBAR LABEL".)  */
   char *quality_bar;
 
-  /* The tooltip to be shown for the qualitybar.  Malloced or NULL.
+  /* The tooltip to be shown for the qualitybar.  NULL if not set.
      (Assuan: "SETQUALITYBAR_TT TOOLTIP".)  */
   char *quality_bar_tt;
 
   /* If this is not NULL, a generate action should be shown.
      There will be an inquiry back to the caller to get such a
-     PIN. generate action.  Malloced or NULL.
+     PIN. generate action.  NULL if not set.
      (Assuan: "SETGENPIN LABEL" .)  */
   char *genpin_label;
 
-  /* The tooltip to be shown for the generate action.  Malloced or NULL.
+  /* The tooltip to be shown for the generate action.  NULL if not set.
      (Assuan: "SETGENPIN_TT TOOLTIP".)  */
   char *genpin_tt;
 
@@ -198,7 +211,7 @@ struct pinentry
   int formatted_passphrase;
 
   /* A hint to be shown near the passphrase input field if passphrase
-     formatting is enabled.  Malloced or NULL.
+     formatting is enabled.  NULL if not set.
      (Assuan: "OPTION formatted-passphrase-hint=HINT".)  */
   char *formatted_passphrase_hint;
 
@@ -213,7 +226,7 @@ struct pinentry
   pinentry_color_t color_qualitybar;
   int color_qualitybar_bright;
 
-  /* Malloced and i18ned default strings or NULL.  These strings may
+  /* I18ned default strings or NULL.  These strings may
      include an underscore character to indicate an accelerator key.
      A double underscore represents a plain one.  */
   /* (Assuan: "OPTION default-ok OK").  */
@@ -253,7 +266,7 @@ struct pinentry
   int may_cache_password;
 
   /* NOTE: If you add any additional fields to this structure, be sure
-     to update the initializer in pinentry/pinentry.c!!!  */
+     to add them to field_table in pinentry/pinentry.c!!!  */
 
   /* For the quality indicator and genpin we need to do an inquiry.
      Thus we need to save the assuan ctx.  */
@@ -270,17 +283,17 @@ struct pinentry
 
   /* A short translated hint for the user with the constraints for new
      passphrases to be displayed near the passphrase input field.
-     Malloced or NULL.
+     NULL if not set.
      (Assuan: "OPTION constraints-hint-short=At least 8 characters".)  */
   char *constraints_hint_short;
 
   /* A longer translated hint for the user with the constraints for new
-     passphrases to be displayed for example as tooltip.  Malloced or NULL.
+     passphrases to be displayed for example as tooltip.  NULL if not set.
      (Assuan: "OPTION constraints-hint-long=The passphrase must ...".)  */
   char *constraints_hint_long;
 
   /* A short translated title for an error dialog informing the user about
-     unsatisfied passphrase constraints.  Malloced or NULL.
+     unsatisfied passphrase constraints.  NULL if not set.
      (Assuan: "OPTION constraints-error-title=Passphrase Not Allowed".)  */
   char *constraints_error_title;
 
@@ -288,6 +301,10 @@ struct pinentry
 typedef struct pinentry *pinentry_t;
 
 
+/* The type of a function the core calls once no Assuan command has
+   been received for a while.  See pinentry_set_idle_handler.  */
+typedef void (*pinentry_idle_handler_t) (void);
+
 /* The pinentry command handler type processes the pinentry request
    PIN.  If PIN->pin is zero, request a confirmation, otherwise a PIN
    entry.  On confirmation, the function should return TRUE if
@@ -322,17 +339,70 @@ int pinentry_inq_quality (pinentry_t pin,
 char *pinentry_inq_checkpin (pinentry_t pin,
                              const char *passphrase, size_t length);
 
+/* The QUALITY and CHECKPIN inquiries may also be run without blocking:
+   start one with the _start function, wait until pinentry_inq_fd is
+   readable, and call pinentry_inq_poll until it returns 1.  The answer
+   is then available from the matching _result function.  Only one
+   inquiry may be outstanding; starting another one fails with
+   GPG_ERR_EAGAIN.  */
+gpg_error_t pinentry_inq_quality_start (pinentry_t pin,
+                                        const char *passphrase,
+                                        size_t length);
+gpg_error_t pinentry_inq_checkpin_start (pinentry_t pin,
+                                         const char *passphrase,
+                                         size_t length);
+
+/* Return the file descriptor the answers to inquiries arrive on, or
+   -1 if there is none.  */
+int pinentry_inq_fd (pinentry_t pin);
+
+/* Read the answer to the outstanding inquiry.  Unless BLOCK is set,
+   only as much as is available without blocking is read.  Returns 1
+   if the answer is complete (or no inquiry is outstanding), 0 if more
+   input is needed and -1 on error.  */
+int pinentry_inq_poll (pinentry_t pin, int block);
+
+/* Wait for the outstanding inquiry, if any, and discard its answer.
+   This must be done before the command handler returns.  */
+void pinentry_inq_abort (pinentry_t pin);
+
+/* Return the answer to a completed QUALITY inquiry.  */
+int pinentry_inq_quality_result (pinentry_t pin);
+
+/* Return the answer to a completed CHECKPIN inquiry, i.e. NULL or a
+   malloced error string.  */
+char *pinentry_inq_checkpin_result (pinentry_t pin);
+
 /* Run a genpin iquriry. Returns a malloced string or NULL */
 char *pinentry_inq_genpin (pinentry_t pin);
 
+/* Return the interval in milliseconds at which a frontend should call
+   pinentry_heartbeat from its event loop while it shows a prompt, or 0
+   if the caller did not ask for heartbeats.  */
+int pinentry_heartbeat_interval (pinentry_t pin);
+
+/* Send a heartbeat status line to the caller if one is due.  It is
+   safe to call this more often than requested.  It uses the Assuan
+   context; a frontend which runs inquiries on another thread must
+   not call it while such an inquiry is in progress.  */
+void pinentry_heartbeat (pinentry_t pin);
+
 /* Try to make room for at least LEN bytes for the pin in the pinentry
    PIN.  Returns new buffer on success and 0 on failure.  */
 char *pinentry_setbufferlen (pinentry_t pin, int len);
 
+/* Copy the passphrase at PASSPHRASE of LENGTH bytes, which need not
+   be Nul terminated, to the buffer of PIN and record its length.
+   Returns the buffer on success and NULL if secure memory is
+   exhausted.  */
+char *pinentry_setbuffer_copy (pinentry_t pin, const char *passphrase,
+                               size_t length);
+
 /* Use the buffer at BUFFER for PIN->PIN.  BUFFER must be NULL or
    allocated using secmem_alloc.  LEN is the size of the buffer.  If
    it is unknown, but BUFFER is a NUL terminated string, you pass 0 to
-   just use strlen(buffer)+1.  */
+   just use strlen(buffer)+1; the length of the passphrase is then
+   recorded as well.  */
 void pinentry_setbuffer_use (pinentry_t pin, char *buffer, int len);
 
 /* Initialize the secure memory subsystem, drop privileges and
@@ -350,6 +420,12 @@ void pinentry_parse_opts (int argc, char *argv[]);
 /* Set the optional flag used with getinfo. */
 void pinentry_set_flavor_flag (const char *string);
 
+/* Call HANDLER whenever no Assuan command has been received for
+   SECONDS seconds.  This allows frontends to release resources they
+   keep between the commands of a session.  */
+void pinentry_set_idle_handler (pinentry_idle_handler_t handler,
+                                int seconds);
+
 
 
 /* The caller must define this variable to process assuan commands.  */
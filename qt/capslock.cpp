@@ -26,6 +26,7 @@
 #include "capslock_p.h"
 
 #include <QGuiApplication>
+#include <QTimer>
 
 #include <QDebug>
 
@@ -33,7 +34,10 @@ CapsLockWatcher::Private::Private(CapsLockWatcher *q)
     : q{q}
 {
 #if PINENTRY_KGUIADDONS
-    watch();
+    // set up the modifier key watching after the dialog has been shown
+    QTimer::singleShot(0, q, [this] () {
+        watch();
+    });
 #endif
 }
 
@@ -41,11 +45,13 @@ CapsLockWatcher::CapsLockWatcher(QObject *parent)
     : QObject{parent}
     , d{new Private{this}}
 {
-    if (qApp->platformName() == QLatin1String("wayland") || qApp->platformName() == QLatin1String("xcb")) {
 #if ! PINENTRY_KGUIADDONS
+    static bool reported = false;
+    if (!reported && (qApp->platformName() == QLatin1String("wayland") || qApp->platformName() == QLatin1String("xcb"))) {
         qWarning() << "CapsLockWatcher was compiled without support for unix";
-#endif
+        reported = true;
     }
+#endif
 }
 
 #include "capslock.moc"
@@ -34,7 +34,6 @@ public:
 
 #if PINENTRY_KGUIADDONS
     void watch();
-    KModifierKeyInfo *keyInfo = nullptr;
 #endif
 private:
 
@@ -28,30 +28,69 @@
 #include <QDebug>
 #include <QGuiApplication>
 
-LockState capsLockState()
+#if PINENTRY_QT_X11 && QT_CONFIG(xcb)
+# include <X11/XKBlib.h>
+# undef Status
+#endif
+
+static bool isSupportedPlatform()
 {
-    static bool reportUnsupportedPlatform = true;
+    static const bool supported = [] () {
+        const QString platform = qApp->platformName();
+#if PINENTRY_KGUIADDONS
+        if (platform == QLatin1String("wayland") || platform == QLatin1String("xcb")) {
+            return true;
+        }
+#elif PINENTRY_QT_X11 && QT_CONFIG(xcb)
+        if (platform == QLatin1String("xcb")) {
+            return true;
+        }
+#endif
+        qWarning() << "Checking for Caps Lock not possible on unsupported platform:" << platform;
+        return false;
+    }();
+    return supported;
+}
 
 #if PINENTRY_KGUIADDONS
-    if (qApp->platformName() != QLatin1String("wayland") && qApp->platformName() != QLatin1String("xcb") && reportUnsupportedPlatform) {
-#else
-    if (reportUnsupportedPlatform) {
+/* All watchers share one KModifierKeyInfo.  It is created on first use,
+ * which is after the dialog has been shown.  */
+static KModifierKeyInfo *sharedKeyInfo()
+{
+    static KModifierKeyInfo *keyInfo = nullptr;
+    if (!keyInfo) {
+        keyInfo = new KModifierKeyInfo{qApp};
+    }
+    return keyInfo;
+}
 #endif
-        qWarning() << "Checking for Caps Lock not possible on unsupported platform:" << qApp->platformName();
+
+LockState capsLockState()
+{
+    if (!isSupportedPlatform()) {
+        return LockState::Unknown;
     }
-    reportUnsupportedPlatform = false;
 #if PINENTRY_KGUIADDONS
-    static KModifierKeyInfo keyInfo;
-    return keyInfo.isKeyLocked(Qt::Key_CapsLock) ? LockState::On : LockState::Off;
-#endif
+    return sharedKeyInfo()->isKeyLocked(Qt::Key_CapsLock) ? LockState::On : LockState::Off;
+#elif PINENTRY_QT_X11 && QT_CONFIG(xcb)
+    auto *const x11App = qGuiApp->nativeInterface<QNativeInterface::QX11Application>();
+    unsigned int state;
+    if (!x11App || XkbGetIndicatorState(x11App->display(), XkbUseCoreKbd, &state) != Success) {
+        return LockState::Unknown;
+    }
+    return (state & 0x01) ? LockState::On : LockState::Off;
+#else
     return LockState::Unknown;
+#endif
 }
 
 #if PINENTRY_KGUIADDONS
 void CapsLockWatcher::Private::watch()
 {
-    keyInfo = new KModifierKeyInfo();
-    connect(keyInfo, &KModifierKeyInfo::keyLocked, q, [=](Qt::Key key, bool locked){
+    if (!isSupportedPlatform()) {
+        return;
+    }
+    connect(sharedKeyInfo(), &KModifierKeyInfo::keyLocked, q, [this](Qt::Key key, bool locked){
         if (key == Qt::Key_CapsLock) {
             Q_EMIT q->stateChanged(locked);
         }
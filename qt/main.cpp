@@ -32,14 +32,19 @@
 #include "pinentryconfirm.h"
 #include "pinentrydialog.h"
 #include "pinentry.h"
+#include "qti18n.h"
+#include "secstring.h"
 #include "util.h"
 
 #include <QApplication>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QEventLoop>
 #include <QIcon>
 #include <QMessageBox>
 #include <QPushButton>
 #include <QString>
+#include <QTimer>
 #include <QWidget>
 #if QT_VERSION >= 0x050000
 #include <QWindow>
@@ -185,11 +190,88 @@ setup_foreground_window(QWidget *widget, const QString &parentWid)
 }
 
 
+/* Seconds without a command after which an accepted passphrase
+ * dialog is hidden.  */
+#define PIN_DIALOG_IDLE_TIMEOUT 3
+
+namespace
+{
+/* The passphrase dialog is kept alive for the whole session, so that
+ * retries (e.g. after a bad passphrase) do not have to build, lay out
+ * and map a new window.  It is only rebuilt if a request needs a
+ * different set of widgets.  */
+struct ReusableDialog {
+    PinEntryDialog *dialog = nullptr;
+    bool hasRepeat = false;
+    bool hasQualityBar = false;
+    int parentWid = 0;
+    QString visibilityTT;
+    QString hideTT;
+};
+ReusableDialog reusableDialog;
+}
+
+static void
+hide_pin_dialog()
+{
+    if (reusableDialog.dialog && reusableDialog.dialog->isVisible()) {
+        reusableDialog.dialog->hide();
+        /* There is no event loop running between commands.  User input
+           for the parked dialog is discarded by its event filter.  */
+        QCoreApplication::processEvents();
+    }
+}
+
+static void
+destroy_pin_dialog()
+{
+    delete reusableDialog.dialog;
+    reusableDialog.dialog = nullptr;
+}
+
+static PinEntryDialog *
+get_pin_dialog(pinentry_t pe, const QString &repeatString,
+               const QString &visibilityTT, const QString &hideTT)
+{
+    ReusableDialog &r = reusableDialog;
+    if (r.dialog
+        && r.hasRepeat == !repeatString.isNull()
+        && r.hasQualityBar == !!pe->quality_bar
+        && r.parentWid == pe->parent_wid
+        && r.visibilityTT == visibilityTT
+        && r.hideTT == hideTT) {
+        r.dialog->prepareForRequest();
+        return r.dialog;
+    }
+
+    destroy_pin_dialog();
+    QElapsedTimer timer;
+    timer.start();
+    r.dialog = new PinEntryDialog(pe, nullptr, 0, true,
+                                  repeatString, visibilityTT, hideTT);
+    logPerfEvent("dialog-created", timer.nsecsElapsed());
+    r.dialog->setKeepMapped(true);
+    r.hasRepeat = !repeatString.isNull();
+    r.hasQualityBar = !!pe->quality_bar;
+    r.parentWid = pe->parent_wid;
+    r.visibilityTT = visibilityTT;
+    r.hideTT = hideTT;
+    if (qApp->platformName() == QStringLiteral("wayland")) {
+        setup_foreground_window(r.dialog, QUrl::fromPercentEncoding(qgetenv("PINENTRY_GEOM_HINT").split(' ')[0]));
+    } else {
+        setup_foreground_window(r.dialog, pe->parent_wid);
+    }
+    return r.dialog;
+}
+
 static int
 qt_cmd_handler(pinentry_t pe)
 {
     int want_pass = !!pe->pin;
 
+    /* Qt's own strings (e.g. in context menus) may be shown from now on.  */
+    loadQtTranslations();
+
     const QString ok =
         pe->ok             ? escape_accel(from_utf8(pe->ok)) :
         pe->default_ok     ? escape_accel(from_utf8(pe->default_ok)) :
@@ -230,14 +312,19 @@ qt_cmd_handler(pinentry_t pe)
         pe->default_pwmngr ? escape_accel(from_utf8(pe->default_pwmngr)) :
         QStringLiteral("Save passphrase in password manager");
 
+    /* Tell the caller that we are still alive while the prompt is
+       shown.  */
+    QTimer heartbeat;
+    if (const int interval = pinentry_heartbeat_interval(pe)) {
+        QObject::connect(&heartbeat, &QTimer::timeout, [pe]() {
+            pinentry_heartbeat(pe);
+        });
+        heartbeat.start(interval);
+    }
+
     if (want_pass) {
-        PinEntryDialog pinentry(pe, nullptr, 0, true,
-                                repeatString, visibilityTT, hideTT);
-        if (qApp->platformName() == QStringLiteral("wayland")) {
-            setup_foreground_window(&pinentry, QUrl::fromPercentEncoding(qgetenv("PINENTRY_GEOM_HINT").split(' ')[0]));
-        } else {
-            setup_foreground_window(&pinentry, pe->parent_wid);
-        }
+        PinEntryDialog &pinentry = *get_pin_dialog(pe, repeatString,
+                                                   visibilityTT, hideTT);
         pinentry.setPrompt(escape_accel(from_utf8(pe->prompt)));
 
         pinentry.setDescription(from_utf8(pe->description));
@@ -260,9 +347,6 @@ qt_cmd_handler(pinentry_t pe)
             pinentry.setWindowTitle(title);
         }
 
-        /* If we reuse the same dialog window.  */
-        pinentry.setPin(QString());
-
         pinentry.setOkText(ok);
         pinentry.setCancelText(cancel);
         if (pe->error) {
@@ -274,33 +358,57 @@ qt_cmd_handler(pinentry_t pe)
         if (pe->quality_bar_tt) {
             pinentry.setQualityBarTT(from_utf8(pe->quality_bar_tt));
         }
-        bool ret = pinentry.exec();
+
+        /* An accepted dialog stays mapped, thus QDialog::exec can't be
+           used; it only returns once the dialog is hidden.  */
+        QEventLoop loop;
+        QObject::connect(&pinentry, &QDialog::finished, &loop, &QEventLoop::quit);
+        QElapsedTimer timer;
+        timer.start();
+        if (!pinentry.isVisible()) {
+            pinentry.show();
+        } else {
+            raiseWindow(&pinentry);
+        }
+        loop.exec();
+        logPerfEvent("getpin-finished", timer.nsecsElapsed());
+        bool ret = pinentry.result() == QDialog::Accepted;
         if (!ret) {
             if (pinentry.timedOut())
                 pe->specific_err = gpg_error (GPG_ERR_TIMEOUT);
             return -1;
         }
 
-        const QString pinStr = pinentry.pin();
-        QByteArray pin = pinStr.toUtf8();
+        SecUtf8String &pin = pinentry.securePin();
+        if (pin.isEmpty() && !pinentry.pin().isEmpty()) {
+            /* The secure memory pool is exhausted.  */
+            pe->specific_err = gpg_error (GPG_ERR_ENOMEM);
+            return -1;
+        }
 
         if (!!pe->repeat_passphrase) {
             /* Should not have been possible to accept
                the dialog in that case but we do a safety
                check here */
-            pe->repeat_okay = (pinStr == pinentry.repeatedPin());
+            pe->repeat_okay = pinentry.repeatedPinMatches();
         }
 
-        int len = strlen(pin.constData());
-        if (len >= 0) {
-            pinentry_setbufferlen(pe, len + 1);
-            if (pe->pin) {
-                strcpy(pe->pin, pin.constData());
-                return len;
-            }
+        /* The passphrase is already in secure memory; hand the buffer
+           over instead of copying it.  */
+        const int len = pin.size();
+        size_t capacity;
+        char *buffer = pin.release(&capacity);
+        /* The dialog may stay on screen until the next request.  */
+        pinentry.clearPassphrase();
+        if (!buffer) {
+            return pinentry_setbuffer_copy(pe, "", 0) ? 0 : -1;
         }
-        return -1;
+        pinentry_setbuffer_use(pe, buffer, static_cast<int>(capacity));
+        pe->pin_datalen = len;
+        return len;
     } else {
+        hide_pin_dialog();
+
         const QString desc  = pe->description ? from_utf8(pe->description) : QString();
         const QString notok = pe->notok       ? escape_accel(from_utf8(pe->notok)) : QString();
 
@@ -345,7 +453,10 @@ qt_cmd_handler(pinentry_t pe)
         box.show();
         raiseWindow(&box);
 
+        QElapsedTimer timer;
+        timer.start();
         const int rc = box.exec();
+        logPerfEvent("confirm-finished", timer.nsecsElapsed());
 
         if (rc == QMessageBox::Cancel) {
             pe->canceled = true;
@@ -359,10 +470,76 @@ qt_cmd_handler(pinentry_t pe)
     }
 }
 
+/* The QApplication is only created when the first command needing a
+ * window arrives, so that sessions consisting of GETINFO, OPTION and
+ * the like do not pay for connecting to the display server.  */
+static QApplication *app = nullptr;
+static int app_argc;
+static char **app_argv;
+
+static QApplication *
+ensure_application()
+{
+    if (app) {
+        return app;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    /* Note: QApplication uses int &argc so argc has to be valid
+     * for the full lifetime of the application.  */
+    app = new QApplication(app_argc, app_argv);
+    app->setWindowIcon(QIcon(QLatin1String(":/icons/pinentry.png")));
+    app->setDesktopFileName(QStringLiteral("org.gnupg.pinentry-qt"));
+    (void) new KeyboardFocusIndication{app};
+    logPerfEvent("qapplication-created", timer.nsecsElapsed());
+    return app;
+}
+
+/* Qt does only understand -display but not --display; thus we are
+ * fixing that here.  The code is pretty simply and may get confused
+ * if an argument is called "--display".
+ *
+ * As Qt might modify argc / argv we use copies here so that we do not
+ * loose options that are handled in both. e.g. display.  */
+static char **
+fixup_argv(int argc, char **argv)
+{
+    char **new_argv, *p;
+    size_t n;
+    int i, done;
+
+    for (n = 0, i = 0; i < argc; i++) {
+        n += strlen(argv[i]) + 1;
+    }
+    n++;
+    new_argv = (char **)calloc(argc + 1, sizeof * new_argv);
+    if (new_argv) {
+        *new_argv = (char *)malloc(n);
+    }
+    if (!new_argv || !*new_argv) {
+        fprintf(stderr, "pinentry-qt: can't fixup argument list: %s\n",
+                strerror(errno));
+        exit(EXIT_FAILURE);
+
+    }
+    for (done = 0, p = *new_argv, i = 0; i < argc; i++)
+        if (!done && !strcmp(argv[i], "--display")) {
+            new_argv[i] = strcpy(p, argv[i] + 1);
+            p += strlen(argv[i] + 1) + 1;
+            done = 1;
+        } else {
+            new_argv[i] = strcpy(p, argv[i]);
+            p += strlen(argv[i]) + 1;
+        }
+
+    return new_argv;
+}
+
 static int
 qt_cmd_handler_ex(pinentry_t pe)
 {
     try {
+        ensure_application();
         return qt_cmd_handler(pe);
     } catch (const InvalidUtf8 &) {
         pe->locale_err = true;
@@ -380,9 +557,6 @@ main(int argc, char *argv[])
 {
     pinentry_init("pinentry-qt");
 
-    QApplication *app = NULL;
-    int new_argc = 0;
-
 #ifdef FALLBACK_CURSES
 #if defined(Q_OS_UNIX) && !defined(Q_OS_DARWIN)
     // check a few environment variables that are usually set on X11 or Wayland sessions
@@ -405,54 +579,18 @@ main(int argc, char *argv[])
     } else
 #endif
     {
-        /* Qt does only understand -display but not --display; thus we
-           are fixing that here.  The code is pretty simply and may get
-           confused if an argument is called "--display". */
-        char **new_argv, *p;
-        size_t n;
-        int i, done;
-
-        for (n = 0, i = 0; i < argc; i++) {
-            n += strlen(argv[i]) + 1;
-        }
-        n++;
-        new_argv = (char **)calloc(argc + 1, sizeof * new_argv);
-        if (new_argv) {
-            *new_argv = (char *)malloc(n);
-        }
-        if (!new_argv || !*new_argv) {
-            fprintf(stderr, "pinentry-qt: can't fixup argument list: %s\n",
-                    strerror(errno));
-            exit(EXIT_FAILURE);
-
-        }
-        for (done = 0, p = *new_argv, i = 0; i < argc; i++)
-            if (!done && !strcmp(argv[i], "--display")) {
-                new_argv[i] = strcpy(p, argv[i] + 1);
-                p += strlen(argv[i] + 1) + 1;
-                done = 1;
-            } else {
-                new_argv[i] = strcpy(p, argv[i]);
-                p += strlen(argv[i]) + 1;
-            }
-
-        /* Note: QApplication uses int &argc so argc has to be valid
-         * for the full lifetime of the application.
-         *
-         * As Qt might modify argc / argv we use copies here so that
-         * we do not loose options that are handled in both. e.g. display.
-         */
-        new_argc = argc;
-        Q_ASSERT (new_argc);
-        app = new QApplication(new_argc, new_argv);
-        app->setWindowIcon(QIcon(QLatin1String(":/icons/pinentry.png")));
-        app->setDesktopFileName(QStringLiteral("org.gnupg.pinentry-qt"));
-        (void) new KeyboardFocusIndication{app};
+        app_argc = argc;
+        Q_ASSERT (app_argc);
+        app_argv = fixup_argv(argc, argv);
+        /* Do not leave an accepted dialog on screen while nothing
+           happens, e.g. after the last command of a session.  */
+        pinentry_set_idle_handler(hide_pin_dialog, PIN_DIALOG_IDLE_TIMEOUT);
     }
 
     pinentry_parse_opts(argc, argv);
 
     int rc = pinentry_loop();
+    destroy_pin_dialog();
     delete app;
     return rc ? EXIT_FAILURE : EXIT_SUCCESS ;
 }
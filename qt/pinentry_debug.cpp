@@ -24,8 +24,37 @@
 
 #include "pinentry_debug.h"
 
+#include <QElapsedTimer>
+
 #if QT_VERSION >= QT_VERSION_CHECK(5, 4, 0)
 Q_LOGGING_CATEGORY(PINENTRY_LOG, "gpg.pinentry", QtWarningMsg)
+Q_LOGGING_CATEGORY(PINENTRY_PERF_LOG, "gpg.pinentry.perf", QtWarningMsg)
 #else
 Q_LOGGING_CATEGORY(PINENTRY_LOG, "gpg.pinentry")
+Q_LOGGING_CATEGORY(PINENTRY_PERF_LOG, "gpg.pinentry.perf")
 #endif
+
+/* Started during static initialization, i.e. before main.  */
+static const QElapsedTimer startTime = [] () {
+    QElapsedTimer timer;
+    timer.start();
+    return timer;
+}();
+
+static QString formatMs(qint64 ns)
+{
+    return QString::number(ns / 1000000.0, 'f', 3);
+}
+
+void logPerfEvent(const char *event, qint64 durationNs)
+{
+    if (!PINENTRY_PERF_LOG().isDebugEnabled()) {
+        return;
+    }
+    QString line = QLatin1String("event=") + QLatin1String(event)
+        + QLatin1String(" t=") + formatMs(startTime.nsecsElapsed());
+    if (durationNs >= 0) {
+        line += QLatin1String(" duration=") + formatMs(durationNs);
+    }
+    qCDebug(PINENTRY_PERF_LOG).noquote() << line;
+}
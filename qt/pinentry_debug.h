@@ -24,5 +24,13 @@
 #include <QLoggingCategory>
 
 Q_DECLARE_LOGGING_CATEGORY(PINENTRY_LOG)
+Q_DECLARE_LOGGING_CATEGORY(PINENTRY_PERF_LOG)
+
+/* Log EVENT to the gpg.pinentry.perf category as one line of the form
+ *   event=<name> t=<ms since start> [duration=<ms>]
+ * DURATIONNS is given in nanoseconds; the duration is omitted if it is
+ * negative.  Times are logged in milliseconds with microsecond
+ * resolution.  */
+void logPerfEvent(const char *event, qint64 durationNs = -1);
 
 #endif // __PINENTRY_QT_DEBUG_H__
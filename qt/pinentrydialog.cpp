@@ -31,7 +31,9 @@
 
 #include "accessibility.h"
 #include "capslock.h"
+#include "pinentry_debug.h"
 #include "pinlineedit.h"
+#include "secstring.h"
 #include "util.h"
 
 #include <QGridLayout>
@@ -41,6 +43,8 @@
 #include <QStyle>
 #include <QStyleHints>
 #include <QPainter>
+#include <QPaintEvent>
+#include <QPixmapCache>
 #include <QPushButton>
 #include <QDialogButtonBox>
 #include <QKeyEvent>
@@ -53,6 +57,7 @@
 #include <QVBoxLayout>
 #include <QMessageBox>
 #include <QRegularExpression>
+#include <QSocketNotifier>
 #include <QAccessible>
 
 #include <QDebug>
@@ -61,6 +66,10 @@
 #include <windows.h>
 #endif
 
+/* Delay in milliseconds before the quality of a changed passphrase is
+   inquired; coalesces the inquiries while the user is typing.  */
+static const int QualityInquiryDelay = 100;
+
 void raiseWindow(QWidget *w)
 {
     w->setWindowState((w->windowState() & ~Qt::WindowMinimized) | Qt::WindowActive);
@@ -68,17 +77,40 @@ void raiseWindow(QWidget *w)
     w->raise();
 }
 
-QPixmap applicationIconPixmap(const QIcon &overlayIcon)
+static int colorScheme()
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+    QStyleHints *styleHints = qApp->styleHints();
+    if (styleHints) {
+        return static_cast<int>(styleHints->colorScheme());
+    }
+#endif
+    return 0;
+}
+
+/* The composed pixmaps are kept in the QPixmapCache, which is owned
+ * by the application, under the resource name of the overlay icon.  */
+QPixmap applicationIconPixmap(const QString &overlayName)
 {
-    QPixmap pm = qApp->windowIcon().pixmap(48, 48);
+    const QString key = QStringLiteral("pinentry-appicon-%1-%2-%3")
+        .arg(overlayName)
+        .arg(qApp->devicePixelRatio())
+        .arg(colorScheme());
+    QPixmap pm;
+    if (QPixmapCache::find(key, &pm)) {
+        return pm;
+    }
 
-    if (!overlayIcon.isNull()) {
+    pm = qApp->windowIcon().pixmap(48, 48);
+
+    if (!overlayName.isEmpty()) {
         QPainter painter(&pm);
         const int emblemSize = 22;
         painter.drawPixmap(pm.width() - emblemSize, 0,
-                           overlayIcon.pixmap(emblemSize, emblemSize));
+                           QIcon{overlayName}.pixmap(emblemSize, emblemSize));
     }
 
+    QPixmapCache::insert(key, pm);
     return pm;
 }
 
@@ -101,6 +133,8 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
 {
     Q_UNUSED(name)
 
+    mConstructionTimer.start();
+
     if (modal) {
         setWindowModality(Qt::ApplicationModal);
     }
@@ -125,6 +159,7 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
     hbox->addWidget(_icon, 0, Qt::AlignVCenter | Qt::AlignLeft);
 
     auto *const grid = new QGridLayout;
+    mGrid = grid;
     int row = 1;
 
     _error = new QLabel{this};
@@ -141,14 +176,10 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
     _desc->hide();
     grid->addWidget(_desc,  row, 1, 1, 2);
 
+    /* The optional hints are only created when they are first shown;
+       reserve their rows here.  */
     row++;
-    mCapsLockHint = new QLabel{this};
-    mCapsLockHint->setTextFormat(Qt::PlainText);
-    mCapsLockHint->setTextInteractionFlags(Qt::TextSelectableByMouse);
-    mCapsLockHint->setPalette(redTextPalette);
-    mCapsLockHint->setAlignment(Qt::AlignCenter);
-    mCapsLockHint->setVisible(false);
-    grid->addWidget(mCapsLockHint, row, 1, 1, 2);
+    mCapsLockHintRow = row;
 
     row++;
     {
@@ -194,21 +225,10 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
     }
 
     row++;
-    mConstraintsHint = new QLabel{this};
-    mConstraintsHint->setTextFormat(Qt::PlainText);
-    mConstraintsHint->setTextInteractionFlags(Qt::TextSelectableByMouse);
-    mConstraintsHint->setVisible(false);
-    grid->addWidget(mConstraintsHint, row, 2);
+    mConstraintsHintRow = row;
 
     row++;
-    mFormattedPassphraseHintSpacer = new QLabel{this};
-    mFormattedPassphraseHintSpacer->setVisible(false);
-    mFormattedPassphraseHint = new QLabel{this};
-    mFormattedPassphraseHint->setTextFormat(Qt::PlainText);
-    mFormattedPassphraseHint->setTextInteractionFlags(Qt::TextSelectableByMouse);
-    mFormattedPassphraseHint->setVisible(false);
-    grid->addWidget(mFormattedPassphraseHintSpacer, row, 1);
-    grid->addWidget(mFormattedPassphraseHint, row, 2);
+    mFormattedPassphraseHintRow = row;
 
     if (!repeatString.isNull()) {
         row++;
@@ -225,12 +245,7 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
         grid->addWidget(mRepeat, row, 2);
 
         row++;
-        mRepeatError = new QLabel{this};
-        mRepeatError->setTextFormat(Qt::PlainText);
-        mRepeatError->setTextInteractionFlags(Qt::TextSelectableByMouse);
-        mRepeatError->setPalette(redTextPalette);
-        mRepeatError->hide();
-        grid->addWidget(mRepeatError, row, 2);
+        mRepeatErrorRow = row;
     }
 
     if (_have_quality_bar) {
@@ -277,11 +292,13 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
     mainLayout->addWidget(buttons);
     mainLayout->setSizeConstraint(QLayout::SetFixedSize);
 
-    if (_pinentry_info->timeout > 0) {
-        _timer = new QTimer(this);
-        connect(_timer, &QTimer::timeout, this, &PinEntryDialog::slotTimeout);
-        _timer->start(_pinentry_info->timeout * 1000);
-    }
+    mQualityTimer = new QTimer{this};
+    mQualityTimer->setSingleShot(true);
+    mQualityTimer->setInterval(QualityInquiryDelay);
+    connect(mQualityTimer, &QTimer::timeout,
+            this, &PinEntryDialog::startQualityInquiry);
+
+    startTimeout();
 
     connect(buttons, &QDialogButtonBox::accepted,
             this, &PinEntryDialog::onAccept);
@@ -315,14 +332,15 @@ PinEntryDialog::PinEntryDialog(pinentry_t pe, QWidget *parent, const char *name,
     auto capsLockWatcher = new CapsLockWatcher{this};
     connect(capsLockWatcher, &CapsLockWatcher::stateChanged,
             this, [this] (bool locked) {
-                mCapsLockHint->setVisible(locked);
+                setCapsLockHintVisible(locked);
             });
 
     connect(qApp, &QApplication::focusChanged,
             this, &PinEntryDialog::focusChanged);
     connect(qApp, &QApplication::applicationStateChanged,
             this, &PinEntryDialog::checkCapsLock);
-    checkCapsLock();
+    // querying the lock state may need some setup; do it after showing the dialog
+    QTimer::singleShot(0, this, &PinEntryDialog::checkCapsLock);
 
 #ifndef QT_NO_ACCESSIBILITY
     QAccessible::installActivationObserver(this);
@@ -356,6 +374,40 @@ PinEntryDialog::~PinEntryDialog()
 #endif
 }
 
+QLabel *PinEntryDialog::addHintLabel(int row, int column, int columnSpan, bool redText)
+{
+    auto *const label = new QLabel{this};
+    label->setTextFormat(Qt::PlainText);
+    label->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    if (redText) {
+        QPalette redTextPalette;
+        redTextPalette.setColor(QPalette::WindowText, Qt::red);
+        label->setPalette(redTextPalette);
+    }
+    label->setVisible(false);
+#ifndef QT_NO_ACCESSIBILITY
+    label->setFocusPolicy(QAccessible::isActive() ? Qt::StrongFocus : Qt::ClickFocus);
+#endif
+    mGrid->addWidget(label, row, column, 1, columnSpan);
+    return label;
+}
+
+void PinEntryDialog::setCapsLockHintVisible(bool visible)
+{
+    if (!visible) {
+        if (mCapsLockHint) {
+            mCapsLockHint->setVisible(false);
+        }
+        return;
+    }
+    if (!mCapsLockHint) {
+        mCapsLockHint = addHintLabel(mCapsLockHintRow, 1, 2, true);
+        mCapsLockHint->setAlignment(Qt::AlignCenter);
+        mCapsLockHint->setText(mCapsLockHintText);
+    }
+    mCapsLockHint->setVisible(true);
+}
+
 void PinEntryDialog::keyPressEvent(QKeyEvent *e)
 {
     const auto returnPressed =
@@ -385,6 +437,15 @@ void PinEntryDialog::showEvent(QShowEvent *event)
     _edit->setFocus();
 }
 
+void PinEntryDialog::paintEvent(QPaintEvent *event)
+{
+    QDialog::paintEvent(event);
+    if (mConstructionTimer.isValid()) {
+        logPerfEvent("dialog-first-paint", mConstructionTimer.nsecsElapsed());
+        mConstructionTimer.invalidate();
+    }
+}
+
 void PinEntryDialog::setDescription(const QString &txt)
 {
     _desc->setVisible(!txt.isEmpty());
@@ -401,7 +462,7 @@ QString PinEntryDialog::description() const
 void PinEntryDialog::setError(const QString &txt)
 {
     if (!txt.isNull()) {
-        _icon->setPixmap(applicationIconPixmap(QIcon{QStringLiteral(":/icons/data-error.svg")}));
+        _icon->setPixmap(applicationIconPixmap(QStringLiteral(":/icons/data-error.svg")));
     }
     _error->setText(txt);
     _error->setVisible(!txt.isEmpty());
@@ -422,6 +483,16 @@ QString PinEntryDialog::pin() const
     return _edit->pin();
 }
 
+const SecUtf8String &PinEntryDialog::securePin() const
+{
+    return _edit->securePin();
+}
+
+SecUtf8String &PinEntryDialog::securePin()
+{
+    return _edit->securePin();
+}
+
 void PinEntryDialog::setPrompt(const QString &txt)
 {
     _prompt->setText(txt);
@@ -481,21 +552,37 @@ void PinEntryDialog::setGenpinTT(const QString &txt)
 
 void PinEntryDialog::setCapsLockHint(const QString &txt)
 {
-    mCapsLockHint->setText(txt);
+    mCapsLockHintText = txt;
+    if (mCapsLockHint) {
+        mCapsLockHint->setText(txt);
+    }
 }
 
 void PinEntryDialog::setFormattedPassphrase(const PinEntryDialog::FormattedPassphraseOptions &options)
 {
     mFormatPassphrase = options.formatPassphrase;
-    mFormattedPassphraseHint->setTextFormat(Qt::RichText);
-    mFormattedPassphraseHint->setText(QLatin1String("<html>") + options.hint.toHtmlEscaped() + QLatin1String("</html>"));
-    Accessibility::setName(mFormattedPassphraseHint, options.hint);
+    mFormattedPassphraseHintText = options.hint;
+    if (mFormattedPassphraseHint) {
+        mFormattedPassphraseHint->setText(QLatin1String("<html>") + options.hint.toHtmlEscaped() + QLatin1String("</html>"));
+        Accessibility::setName(mFormattedPassphraseHint, options.hint);
+    }
     toggleFormattedPassphrase();
 }
 
 void PinEntryDialog::setConstraintsOptions(const ConstraintsOptions &options)
 {
     mEnforceConstraints = options.enforce;
+    mConstraintsErrorTitle = options.errorTitle;
+
+    if (!mEnforceConstraints || options.shortHint.isEmpty()) {
+        if (mConstraintsHint) {
+            mConstraintsHint->setVisible(false);
+        }
+        return;
+    }
+    if (!mConstraintsHint) {
+        mConstraintsHint = addHintLabel(mConstraintsHintRow, 2, 1, false);
+    }
     mConstraintsHint->setText(options.shortHint);
     if (!options.longHint.isEmpty()) {
         mConstraintsHint->setToolTip(QLatin1String("<html>") +
@@ -503,9 +590,7 @@ void PinEntryDialog::setConstraintsOptions(const ConstraintsOptions &options)
                                     QLatin1String("</html>"));
         Accessibility::setDescription(mConstraintsHint, options.longHint);
     }
-    mConstraintsErrorTitle = options.errorTitle;
-
-    mConstraintsHint->setVisible(mEnforceConstraints && !options.shortHint.isEmpty());
+    mConstraintsHint->setVisible(true);
 }
 
 void PinEntryDialog::toggleFormattedPassphrase()
@@ -514,6 +599,18 @@ void PinEntryDialog::toggleFormattedPassphrase()
     _edit->setFormattedPassphrase(enableFormatting);
     if (mRepeat) {
         mRepeat->setFormattedPassphrase(enableFormatting);
+        if (!mFormattedPassphraseHint) {
+            if (!enableFormatting) {
+                return;
+            }
+            mFormattedPassphraseHintSpacer = new QLabel{this};
+            mFormattedPassphraseHintSpacer->setVisible(false);
+            mGrid->addWidget(mFormattedPassphraseHintSpacer, mFormattedPassphraseHintRow, 1);
+            mFormattedPassphraseHint = addHintLabel(mFormattedPassphraseHintRow, 2, 1, false);
+            mFormattedPassphraseHint->setTextFormat(Qt::RichText);
+            mFormattedPassphraseHint->setText(QLatin1String("<html>") + mFormattedPassphraseHintText.toHtmlEscaped() + QLatin1String("</html>"));
+            Accessibility::setName(mFormattedPassphraseHint, mFormattedPassphraseHintText);
+        }
         const bool hintAboutToBeHidden = mFormattedPassphraseHint->isVisible() && !enableFormatting;
         if (hintAboutToBeHidden) {
             // set hint spacer to current height of hint label before hiding the hint
@@ -545,31 +642,281 @@ void PinEntryDialog::onBackspace()
 
 void PinEntryDialog::updateQuality(const QString &txt)
 {
-    int length;
-    int percent;
-    QPalette pal;
+    Q_UNUSED(txt);
 
     _disable_echo_allowed = false;
 
     if (!_have_quality_bar || !_pinentry_info) {
         return;
     }
-    const QByteArray utf8_pin = txt.toUtf8();
-    const char *pin = utf8_pin.constData();
-    length = strlen(pin);
-    percent = length ? pinentry_inq_quality(_pinentry_info, pin, length) : 0;
-    if (!length) {
+    ++mPinSerial;
+    if (_edit->securePin().isEmpty()) {
+        mQualityTimer->stop();
         _quality_bar->reset();
+        _quality_bar->setEnabled(true);
+        return;
+    }
+    if (pinentry_inq_fd(_pinentry_info) < 0) {
+        QElapsedTimer timer;
+        timer.start();
+        setQuality(pinentry_inq_quality(_pinentry_info, _edit->securePin().data(),
+                                        _edit->securePin().size()));
+        logPerfEvent("inquiry-quality", timer.nsecsElapsed());
+        return;
+    }
+    // show that the current value is stale until the new one arrives
+    _quality_bar->setEnabled(false);
+    mQualityTimer->start();
+}
+
+void PinEntryDialog::setQuality(int percent)
+{
+    QPalette pal = _quality_bar->palette();
+    if (percent < 0) {
+        pal.setColor(QPalette::Highlight, QColor("red"));
+        percent = -percent;
     } else {
-        pal = _quality_bar->palette();
-        if (percent < 0) {
-            pal.setColor(QPalette::Highlight, QColor("red"));
-            percent = -percent;
+        pal.setColor(QPalette::Highlight, QColor("green"));
+    }
+    _quality_bar->setPalette(pal);
+    _quality_bar->setValue(percent);
+    _quality_bar->setEnabled(true);
+}
+
+void PinEntryDialog::startQualityInquiry()
+{
+    if (mInquiry != NoInquiry) {
+        // restarted when the running inquiry is finished
+        return;
+    }
+    const SecUtf8String &pin = _edit->securePin();
+    if (pin.isEmpty()) {
+        return;
+    }
+    if (pinentry_inq_quality_start(_pinentry_info, pin.data(), pin.size())) {
+        _quality_bar->setEnabled(true);
+        return;
+    }
+    startInquiry(QualityInquiry);
+}
+
+void PinEntryDialog::startInquiry(Inquiry inquiry)
+{
+    mInquiry = inquiry;
+    mInquirySerial = mPinSerial;
+    mInquiryTimer.start();
+    if (!mInquiryNotifier) {
+        mInquiryNotifier = new QSocketNotifier{pinentry_inq_fd(_pinentry_info),
+                                               QSocketNotifier::Read, this};
+        connect(mInquiryNotifier, &QSocketNotifier::activated,
+                this, &PinEntryDialog::inquiryReadable);
+    }
+    mInquiryNotifier->setEnabled(true);
+}
+
+void PinEntryDialog::inquiryReadable()
+{
+    const int rc = pinentry_inq_poll(_pinentry_info, 0);
+    if (!rc) {
+        return;
+    }
+    mInquiryNotifier->setEnabled(false);
+    const Inquiry inquiry = mInquiry;
+    mInquiry = NoInquiry;
+    logPerfEvent(inquiry == QualityInquiry ? "inquiry-quality" : "inquiry-checkpin",
+                 mInquiryTimer.nsecsElapsed());
+
+    if (inquiry == QualityInquiry) {
+        const int percent = pinentry_inq_quality_result(_pinentry_info);
+        if (mInquirySerial != mPinSerial) {
+            // the passphrase was changed in the meantime
+            if (!_edit->securePin().isEmpty()) {
+                mQualityTimer->start();
+            }
+        } else if (rc > 0) {
+            setQuality(percent);
         } else {
-            pal.setColor(QPalette::Highlight, QColor("green"));
+            _quality_bar->setEnabled(true);
+        }
+        if (mAcceptPending) {
+            startConstraintsCheck();
+        }
+    } else if (inquiry == CheckPinInquiry) {
+        unique_malloced_ptr<char> error{pinentry_inq_checkpin_result(_pinentry_info)};
+        setConstraintsCheckPending(false);
+        if (mInquirySerial != mPinSerial) {
+            // the passphrase was changed while the check was running
+            return;
+        }
+        if (!error) {
+            accept();
+        } else {
+            showConstraintsError(error.get());
+        }
+    }
+}
+
+void PinEntryDialog::cancelInquiry()
+{
+    mQualityTimer->stop();
+    if (mInquiry != NoInquiry) {
+        pinentry_inq_abort(_pinentry_info);
+        mInquiry = NoInquiry;
+        mInquiryNotifier->setEnabled(false);
+    }
+    if (mAcceptPending) {
+        setConstraintsCheckPending(false);
+    }
+}
+
+void PinEntryDialog::done(int result)
+{
+    cancelInquiry();
+    cancelTimeout();
+    if (mKeepMapped && result == QDialog::Accepted) {
+        // Stay on screen while the passphrase is checked, so that a retry
+        // does not have to map the window again.  The dialog can't process
+        // events until the next request; do not keep the keyboard grabbed.
+        if (_grabbed) {
+            if (QWidget *grabber = QWidget::keyboardGrabber()) {
+                grabber->releaseKeyboard();
+            }
+            _grabbed = false;
+        }
+        _edit->setReadOnly(true);
+        if (mRepeat) {
+            mRepeat->setReadOnly(true);
+        }
+        // input queued while parked must not reach the next request
+        if (!mParked) {
+            mParked = true;
+            qApp->installEventFilter(this);
+        }
+        setResult(result);
+        Q_EMIT finished(result);
+        Q_EMIT accepted();
+        return;
+    }
+    QDialog::done(result);
+}
+
+void PinEntryDialog::setKeepMapped(bool keep)
+{
+    mKeepMapped = keep;
+}
+
+void PinEntryDialog::clearPassphrase()
+{
+    _edit->setPin(QString());
+    if (mRepeat) {
+        mRepeat->setPin(QString());
+    }
+}
+
+static bool isUserInputEvent(QEvent::Type type)
+{
+    switch (type) {
+    case QEvent::KeyPress:
+    case QEvent::KeyRelease:
+    case QEvent::ShortcutOverride:
+    case QEvent::InputMethod:
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonRelease:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::Wheel:
+    case QEvent::TouchBegin:
+    case QEvent::TouchUpdate:
+    case QEvent::TouchEnd:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool PinEntryDialog::eventFilter(QObject *watched, QEvent *event)
+{
+    if (mParked && isUserInputEvent(event->type())) {
+        if (watched == windowHandle()) {
+            return true;
+        }
+        auto widget = qobject_cast<QWidget *>(watched);
+        if (widget && widget->window() == this) {
+            return true;
+        }
+    }
+    return QDialog::eventFilter(watched, event);
+}
+
+void PinEntryDialog::prepareForRequest()
+{
+    if (mParked) {
+        // deliver (and thus drop) the input which arrived while parked
+        QCoreApplication::processEvents();
+        qApp->removeEventFilter(this);
+        mParked = false;
+    }
+
+    _timed_out = false;
+    _disable_echo_allowed = true;
+    setResult(0);
+
+    // an error or a tooltip of the last request must not show up again
+    _icon->setPixmap(applicationIconPixmap());
+    _error->clear();
+    _error->hide();
+
+    _edit->setReadOnly(false);
+    _edit->setPin(QString());
+    if (mRepeat) {
+        mRepeat->setReadOnly(false);
+        mRepeat->setPin(QString());
+    }
+    if (mRepeatError) {
+        mRepeatError->hide();
+    }
+    if (mVisiCB) {
+        mVisiCB->setChecked(false);
+    }
+    if (_edit->echoMode() != QLineEdit::Password) {
+        toggleVisibility();
+    }
+    if (_quality_bar) {
+        _quality_bar->reset();
+        _quality_bar->setEnabled(true);
+        _quality_bar->setToolTip(QString());
+    }
+
+    mSavePassphraseCB->setCheckState(!!_pinentry_info->may_cache_password
+                                     ? Qt::Checked
+                                     : Qt::Unchecked);
+#ifdef HAVE_LIBSECRET
+    mSavePassphraseCB->setVisible(_pinentry_info->allow_external_password_cache
+                                  && _pinentry_info->keyinfo);
+#endif
+
+    startTimeout();
+
+    if (isVisible()) {
+        // a parked window gets the focus back without a focus change
+        if ((!_pinentry_info || _pinentry_info->grab) && !_grabbed && _edit->hasFocus()) {
+            _edit->grabKeyboard();
+            _grabbed = true;
+        }
+        _edit->setFocus();
+    }
+}
+
+void PinEntryDialog::startTimeout()
+{
+    if (_pinentry_info->timeout > 0) {
+        if (!_timer) {
+            _timer = new QTimer(this);
+            _timer->setSingleShot(true);
+            connect(_timer, &QTimer::timeout, this, &PinEntryDialog::slotTimeout);
         }
-        _quality_bar->setPalette(pal);
-        _quality_bar->setValue(percent);
+        _timer->start(_pinentry_info->timeout * 1000);
+    } else if (_timer) {
+        _timer->stop();
     }
 }
 
@@ -590,6 +937,7 @@ void PinEntryDialog::focusChanged(QWidget *old, QWidget *now)
         if (!_grabbed && now && (now == _edit || now == mRepeat)) {
             now->grabKeyboard();
             _grabbed = true;
+            logPerfEvent("keyboard-grabbed");
         }
     }
 }
@@ -601,11 +949,11 @@ void PinEntryDialog::textChanged(const QString &text)
     cancelTimeout();
 
     if (mVisiActionEdit && sender() == _edit) {
-        mVisiActionEdit->setVisible(!_edit->pin().isEmpty());
+        mVisiActionEdit->setVisible(!_edit->securePin().isEmpty());
     }
     if (mGenerateButton) {
         mGenerateButton->setVisible(
-            _edit->pin().isEmpty()
+            _edit->securePin().isEmpty()
 #ifndef QT_NO_ACCESSIBILITY
             && !mGenerateButton->accessibleName().isEmpty()
 #endif
@@ -680,6 +1028,11 @@ QString PinEntryDialog::repeatedPin() const
     return QString();
 }
 
+bool PinEntryDialog::repeatedPinMatches() const
+{
+    return !mRepeat || mRepeat->securePin() == _edit->securePin();
+}
+
 bool PinEntryDialog::timedOut() const
 {
     return _timed_out;
@@ -687,6 +1040,7 @@ bool PinEntryDialog::timedOut() const
 
 void PinEntryDialog::setRepeatErrorText(const QString &err)
 {
+    mRepeatErrorText = err;
     if (mRepeatError) {
         mRepeatError->setText(err);
     }
@@ -703,7 +1057,7 @@ void PinEntryDialog::checkCapsLock()
 {
     const auto state = capsLockState();
     if (state != LockState::Unknown) {
-        mCapsLockHint->setVisible(state == LockState::On);
+        setCapsLockHintVisible(state == LockState::On);
     }
 }
 
@@ -711,20 +1065,24 @@ void PinEntryDialog::onAccept()
 {
     cancelTimeout();
 
-    if (mRepeat && mRepeat->pin() != _edit->pin()) {
+    if (!repeatedPinMatches()) {
 #ifndef QT_NO_ACCESSIBILITY
         if (QAccessible::isActive()) {
-            QMessageBox::information(this, mRepeatError->text(), mRepeatError->text());
+            QMessageBox::information(this, mRepeatErrorText, mRepeatErrorText);
         } else
 #endif
         {
+            if (!mRepeatError) {
+                mRepeatError = addHintLabel(mRepeatErrorRow, 2, 1, true);
+                mRepeatError->setText(mRepeatErrorText);
+            }
             mRepeatError->setVisible(true);
         }
         return;
     }
 
     const auto result = checkConstraints();
-    if (result != PassphraseNotOk) {
+    if (result == PassphraseNotChecked || result == PassphraseOk) {
         accept();
     }
 }
@@ -736,33 +1094,79 @@ void PinEntryDialog::accessibilityActiveChanged(bool active)
     const auto focusPolicy = active ? Qt::StrongFocus : Qt::ClickFocus;
     _error->setFocusPolicy(focusPolicy);
     _desc->setFocusPolicy(focusPolicy);
-    mCapsLockHint->setFocusPolicy(focusPolicy);
-    mConstraintsHint->setFocusPolicy(focusPolicy);
-    mFormattedPassphraseHint->setFocusPolicy(focusPolicy);
-    if (mRepeatError) {
-        mRepeatError->setFocusPolicy(focusPolicy);
+    for (QLabel *label : {mCapsLockHint, mConstraintsHint, mFormattedPassphraseHint, mRepeatError}) {
+        if (label) {
+            label->setFocusPolicy(focusPolicy);
+        }
     }
 }
 #endif
 
+void PinEntryDialog::startConstraintsCheck()
+{
+    if (mInquiry != NoInquiry) {
+        // started when the running inquiry is finished
+        return;
+    }
+    mQualityTimer->stop();
+    const SecUtf8String &passphrase = _edit->securePin();
+    if (pinentry_inq_checkpin_start(_pinentry_info, passphrase.data(), passphrase.size())) {
+        // the passphrase can't be checked; behave as if it was fine
+        setConstraintsCheckPending(false);
+        accept();
+        return;
+    }
+    startInquiry(CheckPinInquiry);
+}
+
+void PinEntryDialog::setConstraintsCheckPending(bool pending)
+{
+    mAcceptPending = pending;
+    _ok->setEnabled(!pending);
+    _edit->setReadOnly(pending);
+    if (mRepeat) {
+        mRepeat->setReadOnly(pending);
+    }
+    if (pending) {
+        setCursor(Qt::BusyCursor);
+    } else {
+        unsetCursor();
+    }
+}
+
 PinEntryDialog::PassphraseCheckResult PinEntryDialog::checkConstraints()
 {
     if (!mEnforceConstraints) {
         return PassphraseNotChecked;
     }
 
-    const auto passphrase = _edit->pin().toUtf8();
+    if (pinentry_inq_fd(_pinentry_info) >= 0) {
+        setConstraintsCheckPending(true);
+        startConstraintsCheck();
+        return PassphraseCheckPending;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const SecUtf8String &passphrase = _edit->securePin();
     unique_malloced_ptr<char> error{pinentry_inq_checkpin(
-        _pinentry_info, passphrase.constData(), passphrase.size())};
+        _pinentry_info, passphrase.data(), passphrase.size())};
+    logPerfEvent("inquiry-checkpin", timer.nsecsElapsed());
 
     if (!error) {
         return PassphraseOk;
     }
+    showConstraintsError(error.get());
+    return PassphraseNotOk;
+}
 
-    const auto messageLines = QString::fromUtf8(QByteArray::fromPercentEncoding(error.get())).split(QChar{'\n'});
+void PinEntryDialog::showConstraintsError(const char *error)
+{
+    const auto messageLines = QString::fromUtf8(QByteArray::fromPercentEncoding(error)).split(QChar{'\n'});
     if (messageLines.isEmpty()) {
         // shouldn't happen because pinentry_inq_checkpin() either returns NULL or a non-empty string
-        return PassphraseOk;
+        accept();
+        return;
     }
     const auto firstLine = messageLines.first();
     const auto indexOfFirstNonEmptyAdditionalLine = messageLines.indexOf(QRegularExpression{QStringLiteral(".*\\S.*")}, 1);
@@ -774,7 +1178,6 @@ PinEntryDialog::PassphraseCheckResult PinEntryDialog::checkConstraints()
     messageBox.setInformativeText(additionalLines);
     messageBox.setStandardButtons(QMessageBox::Ok);
     messageBox.exec();
-    return PassphraseNotOk;
 }
 
 #include "pinentrydialog.moc"
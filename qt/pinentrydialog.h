@@ -28,22 +28,26 @@
 
 #include <QAccessible>
 #include <QDialog>
+#include <QElapsedTimer>
 #include <QStyle>
 #include <QTimer>
 
 #include "pinentry.h"
 
 class QIcon;
+class QGridLayout;
 class QLabel;
 class QPushButton;
 class QLineEdit;
 class PinLineEdit;
 class QString;
+class SecUtf8String;
 class QProgressBar;
+class QSocketNotifier;
 class QCheckBox;
 class QAction;
 
-QPixmap applicationIconPixmap(const QIcon &overlayIcon = {});
+QPixmap applicationIconPixmap(const QString &overlayName = {});
 
 void raiseWindow(QWidget *w);
 
@@ -87,8 +91,11 @@ public:
 
     void setPin(const QString &);
     QString pin() const;
+    const SecUtf8String &securePin() const;
+    SecUtf8String &securePin();
 
     QString repeatedPin() const;
+    bool repeatedPinMatches() const;
     void setRepeatErrorText(const QString &);
 
     void setPrompt(const QString &);
@@ -113,6 +120,21 @@ public:
 
     bool timedOut() const;
 
+    void done(int result) override;
+
+    /* If set, accepting the dialog does not hide it; the window stays
+       mapped (but inert) until the next request or until it is hidden
+       explicitly.  User input for a parked window is discarded.  */
+    void setKeepMapped(bool keep);
+
+    /* Wipe the entered passphrase(s), e.g. once an accepted passphrase
+       has been handed over while the dialog stays mapped.  */
+    void clearPassphrase();
+
+    /* Reset the per-request state, so that the dialog can be shown
+       again for another request.  */
+    void prepareForRequest();
+
 protected Q_SLOTS:
     void updateQuality(const QString &);
     void slotTimeout();
@@ -128,8 +150,12 @@ protected:
     void keyPressEvent(QKeyEvent *event) override;
     void keyReleaseEvent(QKeyEvent *event) override;
     void showEvent(QShowEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
+    bool eventFilter(QObject *watched, QEvent *event) override;
 
 private Q_SLOTS:
+    void startQualityInquiry();
+    void inquiryReadable();
     void cancelTimeout();
     void checkCapsLock();
     void onAccept();
@@ -142,9 +168,26 @@ private:
     enum PassphraseCheckResult {
         PassphraseNotChecked = -1,
         PassphraseNotOk = 0,
-        PassphraseOk
+        PassphraseOk,
+        PassphraseCheckPending
     };
     PassphraseCheckResult checkConstraints();
+    void showConstraintsError(const char *error);
+    void startConstraintsCheck();
+    void setConstraintsCheckPending(bool pending);
+
+    enum Inquiry {
+        NoInquiry,
+        QualityInquiry,
+        CheckPinInquiry
+    };
+    void startInquiry(Inquiry inquiry);
+    void cancelInquiry();
+    void setQuality(int percent);
+    void startTimeout();
+
+    QLabel *addHintLabel(int row, int column, int columnSpan, bool redText);
+    void setCapsLockHintVisible(bool visible);
 
 private:
     QLabel    *_icon = nullptr;
@@ -156,6 +199,7 @@ private:
     PinLineEdit *_edit = nullptr;
     PinLineEdit *mRepeat = nullptr;
     QLabel      *mRepeatError = nullptr;
+    QString     mRepeatErrorText;
     QPushButton *_ok = nullptr;
     QPushButton *_cancel = nullptr;
     bool       _grabbed = false;
@@ -173,11 +217,28 @@ private:
     QCheckBox *mVisiCB = nullptr;
     QLabel    *mFormattedPassphraseHint = nullptr;
     QLabel    *mFormattedPassphraseHintSpacer = nullptr;
+    QString   mFormattedPassphraseHintText;
     QLabel    *mCapsLockHint = nullptr;
+    QString   mCapsLockHintText;
     QLabel    *mConstraintsHint = nullptr;
     QString   mConstraintsErrorTitle;
     QCheckBox *mSavePassphraseCB = nullptr;
     QString   mIconSuffix;
+    QGridLayout *mGrid = nullptr;
+    int       mCapsLockHintRow = 0;
+    int       mConstraintsHintRow = 0;
+    int       mFormattedPassphraseHintRow = 0;
+    int       mRepeatErrorRow = 0;
+    QElapsedTimer mConstructionTimer;
+    QElapsedTimer mInquiryTimer;
+    QTimer    *mQualityTimer = nullptr;
+    QSocketNotifier *mInquiryNotifier = nullptr;
+    Inquiry   mInquiry = NoInquiry;
+    unsigned int mPinSerial = 0;
+    unsigned int mInquirySerial = 0;
+    bool      mAcceptPending = false;
+    bool      mKeepMapped = false;
+    bool      mParked = false;
 };
 
 #endif // __PINENTRYDIALOG_H__
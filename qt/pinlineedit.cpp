@@ -21,6 +21,8 @@
 
 #include "pinlineedit.h"
 
+#include "secstring.h"
+
 #include <QClipboard>
 #include <QGuiApplication>
 #include <QKeyEvent>
@@ -49,14 +51,34 @@ public:
         : q{q}
     {}
 
-    QString formatted(QString text) const
+    QString formatted(QStringView text) const
     {
-        const int dashCount = text.size() / FormattedPassphraseGroupSize;
-        text.reserve(text.size() + dashCount);
-        for (int i = FormattedPassphraseGroupSize; i < text.size(); i += FormattedPassphraseGroupSize + 1) {
-            text.insert(i, FormattedPassphraseSeparator);
+        QString result;
+        result.reserve(text.size() + text.size() / FormattedPassphraseGroupSize);
+        for (int i = 0; i < text.size(); ++i) {
+            if (i && i % FormattedPassphraseGroupSize == 0) {
+                result += FormattedPassphraseSeparator;
+            }
+            result += text[i];
         }
-        return text;
+        return result;
+    }
+
+    // Returns the position of the first character of the formatted text
+    // which is not where formatted() would have put it, or -1 if the text
+    // is formatted correctly.
+    int firstMisformattedPosition(QStringView text) const
+    {
+        for (int i = 0; i < text.size(); ++i) {
+            const bool separatorExpected = i % (FormattedPassphraseGroupSize + 1) == FormattedPassphraseGroupSize;
+            if (separatorExpected != (text[i] == FormattedPassphraseSeparator)) {
+                return i;
+            }
+        }
+        if (!text.isEmpty() && text.back() == FormattedPassphraseSeparator) {
+            return text.size() - 1;
+        }
+        return -1;
     }
 
     Selection formattedSelection(Selection selection) const
@@ -70,12 +92,16 @@ public:
         };
     }
 
-    QString unformatted(QString text) const
+    QString unformatted(QStringView text) const
     {
-        for (int i = FormattedPassphraseGroupSize; i < text.size(); i += FormattedPassphraseGroupSize) {
-            text.remove(i, 1);
+        QString result;
+        result.reserve(text.size());
+        for (int i = 0; i < text.size(); ++i) {
+            if (i % (FormattedPassphraseGroupSize + 1) != FormattedPassphraseGroupSize) {
+                result += text[i];
+            }
         }
-        return text;
+        return result;
     }
 
     Selection unformattedSelection(Selection selection) const
@@ -113,8 +139,15 @@ public:
 #endif
     }
 
+    void updateSecurePin()
+    {
+        mSecurePin.assign(q->text(),
+                          mFormattedPassphrase ? FormattedPassphraseSeparator : QChar{});
+    }
+
 public:
     bool mFormattedPassphrase = false;
+    SecUtf8String mSecurePin;
 };
 
 PinLineEdit::PinLineEdit(QWidget *parent)
@@ -123,6 +156,8 @@ PinLineEdit::PinLineEdit(QWidget *parent)
 {
     connect(this, SIGNAL(textEdited(QString)),
             this, SLOT(textEdited()));
+    connect(this, &QLineEdit::textChanged,
+            this, [this]() { d->updateSecurePin(); });
 }
 
 PinLineEdit::~PinLineEdit() = default;
@@ -173,6 +208,16 @@ QString PinLineEdit::pin() const
     }
 }
 
+const SecUtf8String &PinLineEdit::securePin() const
+{
+    return d->mSecurePin;
+}
+
+SecUtf8String &PinLineEdit::securePin()
+{
+    return d->mSecurePin;
+}
+
 void PinLineEdit::keyPressEvent(QKeyEvent *e)
 {
     if (e == QKeySequence::Copy) {
@@ -215,17 +260,25 @@ void PinLineEdit::textEdited()
     if (!d->mFormattedPassphrase) {
         return;
     }
-    auto currentText = text();
+    const auto currentText = text();
+    // most edits, e.g. typing inside a group, leave the formatting intact;
+    // do not touch the text then, so that the undo history is kept
+    const int firstBad = d->firstMisformattedPosition(currentText);
+    if (firstBad < 0) {
+        return;
+    }
     // first calculate the cursor position in the reformatted text; the cursor
     // is put left of the separators, so that backspace works as expected
     auto cursorPos = cursorPosition();
     cursorPos -= QStringView{currentText}.left(cursorPos).count(FormattedPassphraseSeparator);
     cursorPos += std::max(cursorPos - 1, 0) / FormattedPassphraseGroupSize;
-    // then reformat the text
-    currentText.remove(FormattedPassphraseSeparator);
-    currentText = d->formatted(currentText);
+    // then reformat the text starting with the group containing the first
+    // misplaced character; everything before it is already correct
+    const int groupStart = firstBad - firstBad % (FormattedPassphraseGroupSize + 1);
+    QString tail = QStringView{currentText}.mid(groupStart).toString();
+    tail.remove(FormattedPassphraseSeparator);
     // finally, set reformatted text and updated cursor position
-    setText(currentText);
+    setText(currentText.left(groupStart) + d->formatted(tail));
     setCursorPosition(cursorPos);
 }
 
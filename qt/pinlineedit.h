@@ -26,6 +26,8 @@
 
 #include <memory>
 
+class SecUtf8String;
+
 class PinLineEdit : public QLineEdit
 {
     Q_OBJECT
@@ -37,6 +39,11 @@ public:
     void setPin(const QString &pin);
     QString pin() const;
 
+    /* The unformatted passphrase as UTF-8 in secure memory.  It is kept
+     * in sync with the text of the line edit.  */
+    const SecUtf8String &securePin() const;
+    SecUtf8String &securePin();
+
 public Q_SLOTS:
     void setFormattedPassphrase(bool on);
     void copy() const;
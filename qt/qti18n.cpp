@@ -20,47 +20,101 @@
  * SPDX-License-Identifier: GPL-2.0+
  */
 
+#include "qti18n.h"
+
 #include <QDebug>
 #include <QCoreApplication>
+#include <QDateTime>
+#include <QFileInfo>
 #include <QLibraryInfo>
 #include <QLocale>
+#include <QSettings>
+#include <QStandardPaths>
 #include <QTranslator>
 
 #include <memory>
 
-static bool loadCatalog(const QString &catalog, const QLocale &locale)
+/* The resolved catalog files are cached, so that later starts do not
+ * have to search the translations directory for every candidate name.
+ * A cached empty path means that there is no catalog for the locale.
+ * The cache is dropped if Qt or its translations directory change,
+ * including when a catalog is added to or removed from the directory,
+ * which updates its modification time.  */
+static std::unique_ptr<QSettings> openCatalogCache()
 {
+    const QString cacheDir = QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation);
+    if (cacheDir.isEmpty()) {
+        return {};
+    }
+    std::unique_ptr<QSettings> cache{new QSettings{cacheDir + QLatin1String("/pinentry-qt/translations.ini"),
+                                                   QSettings::IniFormat}};
+    const QString qtVersion = QLatin1String(qVersion());
+    const QString translationsPath = QLibraryInfo::path(QLibraryInfo::TranslationsPath);
+    const qint64 translationsModified = QFileInfo{translationsPath}.lastModified().toMSecsSinceEpoch();
+    if (cache->value(QStringLiteral("QtVersion")).toString() != qtVersion
+        || cache->value(QStringLiteral("TranslationsPath")).toString() != translationsPath
+        || cache->value(QStringLiteral("TranslationsModified")).toLongLong() != translationsModified) {
+        cache->clear();
+        cache->setValue(QStringLiteral("QtVersion"), qtVersion);
+        cache->setValue(QStringLiteral("TranslationsPath"), translationsPath);
+        cache->setValue(QStringLiteral("TranslationsModified"), translationsModified);
+    }
+    return cache;
+}
+
+static bool loadCatalog(const QString &catalog, const QLocale &locale, QSettings *cache)
+{
+    const QString key = QLatin1String("Catalogs/") + catalog + locale.name();
     auto translator = new QTranslator(QCoreApplication::instance());
 
+    if (cache && cache->contains(key)) {
+        const QString path = cache->value(key).toString();
+        if (path.isEmpty()) {
+            delete translator;
+            return false;
+        }
+        if (translator->load(path)) {
+            QCoreApplication::instance()->installTranslator(translator);
+            return true;
+        }
+        // the cached file is gone; search for the catalog again
+    }
+
     if (!translator->load(locale, catalog, QString(), QLibraryInfo::path(QLibraryInfo::TranslationsPath))) {
         qDebug() << "Loading the" << catalog << "catalog failed for locale" << locale;
         delete translator;
+        if (cache) {
+            cache->setValue(key, QString());
+        }
         return false;
     }
+    if (cache) {
+        cache->setValue(key, translator->filePath());
+    }
     QCoreApplication::instance()->installTranslator(translator);
     return true;
 }
 
-static bool loadCatalog(const QString &catalog, const QLocale &locale, const QLocale &fallbackLocale)
+static bool loadCatalog(const QString &catalog, const QLocale &locale, const QLocale &fallbackLocale, QSettings *cache)
 {
     // try to load the catalog for locale
-    if (loadCatalog(catalog, locale)) {
+    if (loadCatalog(catalog, locale, cache)) {
         return true;
     }
     // if this fails, then try the fallback locale (if it's different from locale)
     if (fallbackLocale != locale) {
-        return loadCatalog(catalog, fallbackLocale);
+        return loadCatalog(catalog, fallbackLocale, cache);
     }
     return false;
 }
 
 // load global Qt translation, needed in KDE e.g. by lots of builtin dialogs (QColorDialog, QFontDialog) that we use
-static void loadTranslation(const QString &localeName, const QString &fallbackLocaleName)
+static void loadTranslation(const QString &localeName, const QString &fallbackLocaleName, QSettings *cache)
 {
     const QLocale locale{localeName};
     const QLocale fallbackLocale{fallbackLocaleName};
     // first, try to load the qt_ meta catalog
-    if (loadCatalog(QStringLiteral("qt_"), locale, fallbackLocale)) {
+    if (loadCatalog(QStringLiteral("qt_"), locale, fallbackLocale, cache)) {
         return;
     }
     // if loading the meta catalog failed, then try loading the four catalogs
@@ -72,22 +126,28 @@ static void loadTranslation(const QString &localeName, const QString &fallbackLo
         QStringLiteral("qtxmlpatterns_"), */
     };
     for (const auto &catalog : catalogs) {
-        loadCatalog(catalog, locale, fallbackLocale);
+        loadCatalog(catalog, locale, fallbackLocale, cache);
     }
 }
 
-static void load()
+void loadQtTranslations()
 {
+    static bool loaded = false;
+    if (loaded || !QCoreApplication::instance()) {
+        return;
+    }
+    loaded = true;
+
+    const auto cache = openCatalogCache();
+
     // The way Qt translation system handles plural forms makes it necessary to
     // have a translation file which contains only plural forms for `en`. That's
     // why we load the `en` translation unconditionally, then load the
     // translation for the current locale to overload it.
-    loadCatalog(QStringLiteral("qt_"), QLocale{QStringLiteral("en")});
+    loadCatalog(QStringLiteral("qt_"), QLocale{QStringLiteral("en")}, cache.get());
 
     const QLocale locale = QLocale::system();
     if (locale.name() != QStringLiteral("en")) {
-        loadTranslation(locale.name(), locale.bcp47Name());
+        loadTranslation(locale.name(), locale.bcp47Name(), cache.get());
     }
 }
-
-Q_COREAPP_STARTUP_FUNCTION(load)
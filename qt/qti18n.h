@@ -0,0 +1,26 @@
+/* qti18n.h - Load qt translations for pinentry.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#ifndef __PINENTRY_QT_I18N_H__
+#define __PINENTRY_QT_I18N_H__
+
+/* Install the Qt translations for the system locale.  This is done
+ * on first use instead of at startup; later calls do nothing.  */
+void loadQtTranslations();
+
+#endif // __PINENTRY_QT_I18N_H__
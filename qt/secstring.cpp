@@ -0,0 +1,129 @@
+/* secstring.cpp - UTF-8 string in secure memory.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#include "secstring.h"
+
+#include "secmem.h"
+#include "secmem-util.h"
+
+#include <QString>
+
+#include <string.h>
+
+SecUtf8String::~SecUtf8String()
+{
+    if (mData) {
+        wipememory(mData, mCapacity);
+        secmem_free(mData);
+    }
+}
+
+bool SecUtf8String::reserve(size_t capacity)
+{
+    if (capacity <= mCapacity) {
+        return true;
+    }
+    /* Do not use secmem_realloc; it neither wipes the old block nor
+     * copes with an exhausted pool.  */
+    char *data = static_cast<char *>(secmem_malloc(capacity));
+    if (!data) {
+        return false;
+    }
+    if (mData) {
+        memcpy(data, mData, mSize + 1);
+        wipememory(mData, mCapacity);
+        secmem_free(mData);
+    } else {
+        data[0] = 0;
+    }
+    mData = data;
+    mCapacity = capacity;
+    return true;
+}
+
+void SecUtf8String::clear()
+{
+    if (mData) {
+        wipememory(mData, mSize);
+        mData[0] = 0;
+    }
+    mSize = 0;
+}
+
+char *SecUtf8String::release(size_t *capacity)
+{
+    char *data = mData;
+
+    *capacity = mCapacity;
+    mData = nullptr;
+    mSize = 0;
+    mCapacity = 0;
+    return data;
+}
+
+bool SecUtf8String::assign(const QString &text, QChar skip)
+{
+    const QChar *src = text.constData();
+    const size_t length = text.size();
+
+    clear();
+    /* A UTF-16 code unit never needs more than three UTF-8 bytes; a
+     * surrogate pair needs four bytes for two units.  */
+    if (!reserve(3 * length + 1)) {
+        return false;
+    }
+
+    unsigned char *dst = reinterpret_cast<unsigned char *>(mData);
+    for (size_t i = 0; i < length; i++) {
+        unsigned int uc = src[i].unicode();
+
+        if (!skip.isNull() && uc == skip.unicode()) {
+            continue;
+        }
+        if (QChar::isHighSurrogate(uc) && i + 1 < length
+            && QChar::isLowSurrogate(src[i + 1].unicode())) {
+            uc = QChar::surrogateToUcs4(uc, src[++i].unicode());
+        } else if (QChar::isSurrogate(uc)) {
+            uc = QChar::ReplacementCharacter;
+        }
+
+        if (uc < 0x80) {
+            *dst++ = uc;
+        } else if (uc < 0x800) {
+            *dst++ = 0xc0 | (uc >> 6);
+            *dst++ = 0x80 | (uc & 0x3f);
+        } else if (uc < 0x10000) {
+            *dst++ = 0xe0 | (uc >> 12);
+            *dst++ = 0x80 | ((uc >> 6) & 0x3f);
+            *dst++ = 0x80 | (uc & 0x3f);
+        } else {
+            *dst++ = 0xf0 | (uc >> 18);
+            *dst++ = 0x80 | ((uc >> 12) & 0x3f);
+            *dst++ = 0x80 | ((uc >> 6) & 0x3f);
+            *dst++ = 0x80 | (uc & 0x3f);
+        }
+    }
+    *dst = 0;
+    mSize = reinterpret_cast<char *>(dst) - mData;
+    return true;
+}
+
+bool SecUtf8String::operator==(const SecUtf8String &other) const
+{
+    return mSize == other.mSize && !memcmp(data(), other.data(), mSize);
+}
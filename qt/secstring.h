@@ -0,0 +1,67 @@
+/* secstring.h - UTF-8 string in secure memory.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+#ifndef __PINENTRY_QT_SECSTRING_H__
+#define __PINENTRY_QT_SECSTRING_H__
+
+#include <QChar>
+
+#include <stddef.h>
+
+class QString;
+
+/* A NUL terminated UTF-8 string which lives in the secmem pool.  The
+ * buffer is only grown, never shrunk, so that re-encoding the passphrase
+ * on every keystroke does not allocate.  Old contents are wiped before
+ * the memory is released or reused.  */
+class SecUtf8String
+{
+public:
+    SecUtf8String() = default;
+    ~SecUtf8String();
+
+    SecUtf8String(const SecUtf8String &) = delete;
+    SecUtf8String &operator=(const SecUtf8String &) = delete;
+
+    /* Replace the contents with the UTF-8 encoding of TEXT, dropping
+     * all occurrences of SKIP (if it is not null).  Returns false if
+     * the secure memory is exhausted; the string is then empty.  */
+    bool assign(const QString &text, QChar skip = QChar{});
+    void clear();
+
+    /* Hand the buffer over to the caller, who must release it with
+     * secmem_free, and store its size at CAPACITY.  Returns nullptr if
+     * nothing was ever assigned.  The string is empty afterwards.  */
+    char *release(size_t *capacity);
+
+    const char *data() const { return mData ? mData : ""; }
+    size_t size() const { return mSize; }
+    bool isEmpty() const { return mSize == 0; }
+
+    bool operator==(const SecUtf8String &other) const;
+    bool operator!=(const SecUtf8String &other) const { return !(*this == other); }
+
+private:
+    bool reserve(size_t capacity);
+
+    char *mData = nullptr;
+    size_t mSize = 0;
+    size_t mCapacity = 0;
+};
+
+#endif // __PINENTRY_QT_SECSTRING_H__
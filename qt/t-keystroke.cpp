@@ -0,0 +1,343 @@
+/* t-keystroke.cpp - Keystroke latency of the passphrase dialog.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This test runs the Assuan loop of libpinentry in-process with a
+ * command handler that shows a PinEntryDialog with a quality bar on
+ * Qt's offscreen platform.  A forked child plays gpg-agent over a
+ * socketpair: it asks for a passphrase and answers every INQUIRE
+ * QUALITY only after T_QUALITY_DELAY milliseconds (default 2000).
+ * While the first inquiry is pending, keys are sent to the
+ * PinLineEdit with QTest::keyClick and the time from each key to the
+ * next paint of the line edit is measured.  The test fails if it
+ * exceeds T_KEY_BUDGET milliseconds (default 200), i.e. if typing
+ * waits for the inquiry, or if the quality is not shown once the
+ * answer arrives.  */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "pinentrydialog.h"
+#include "pinlineedit.h"
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QProgressBar>
+#ifndef QT_WIDGETS_LIB
+# define QT_WIDGETS_LIB 1 /* Enable the widget functions of QTest.  */
+#endif
+#include <QTest>
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PGM "t-keystroke"
+
+/* The quality the agent answers.  */
+static const int AgentQuality = 42;
+
+/* The keys typed while the inquiry is pending.  */
+static const char PendingKeys[] = "orrect";
+
+static int qualityDelay;
+static int keyBudget;
+static int notifyFd = -1;
+static bool handlerRan;
+static bool failed;
+static QElapsedTimer testClock;
+
+static int env_int(const char *name, int dflt)
+{
+    const char *s = getenv(name);
+
+    return s && *s ? atoi(s) : dflt;
+}
+
+static void fail(const char *message)
+{
+    fprintf(stderr, PGM ": %s\n", message);
+    failed = true;
+}
+
+/* Read a line from FD into LINE without the LF.  Returns false on
+ * EOF or error.  The agent reads byte by byte, which keeps it simple
+ * and is fast enough for a handful of lines.  */
+static bool read_line(int fd, char *line, size_t linesize)
+{
+    size_t len = 0;
+
+    for (;;) {
+        char c;
+        const ssize_t n = read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        if (c == '\n') {
+            break;
+        }
+        if (len + 1 < linesize) {
+            line[len++] = c;
+        }
+    }
+    line[len] = 0;
+    return true;
+}
+
+static bool send_line(int fd, const char *line)
+{
+    const size_t len = strlen(line);
+
+    return write(fd, line, len) == (ssize_t)len && write(fd, "\n", 1) == 1;
+}
+
+/* Read the response to a command from FD and return true for OK.
+ * QUALITY inquiries are reported on NOTIFY_FD and answered after
+ * DELAY milliseconds.  */
+static bool read_response(int fd, int notify_fd, int delay)
+{
+    char line[1024];
+
+    while (read_line(fd, line, sizeof line)) {
+        if (!strncmp(line, "OK", 2)) {
+            return true;
+        }
+        if (!strncmp(line, "ERR", 3)) {
+            return false;
+        }
+        if (!strncmp(line, "INQUIRE QUALITY ", 16)) {
+            char answer[32];
+
+            if (write(notify_fd, "Q", 1) != 1) {
+                return false;
+            }
+            poll(nullptr, 0, delay);
+            snprintf(answer, sizeof answer, "D %d", AgentQuality);
+            if (!send_line(fd, answer) || !send_line(fd, "END")) {
+                return false;
+            }
+        } else if (!strncmp(line, "INQUIRE ", 8)) {
+            if (!send_line(fd, "END")) {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+/* Play gpg-agent on FD.  Returns the exit status of the child.  */
+static int run_agent(int fd, int notify_fd, int delay)
+{
+    char line[1024];
+
+    if (!read_line(fd, line, sizeof line) || strncmp(line, "OK", 2)) {
+        fprintf(stderr, PGM ": agent: no greeting\n");
+        return 1;
+    }
+    if (!send_line(fd, "SETQUALITYBAR Quality:")
+        || !read_response(fd, notify_fd, delay)) {
+        fprintf(stderr, PGM ": agent: SETQUALITYBAR failed\n");
+        return 1;
+    }
+    /* The dialog is cancelled by the test, thus GETPIN fails.  */
+    if (!send_line(fd, "GETPIN")) {
+        return 1;
+    }
+    read_response(fd, notify_fd, delay);
+    if (!send_line(fd, "BYE") || !read_response(fd, notify_fd, delay)) {
+        fprintf(stderr, PGM ": agent: BYE failed\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Records the time of the last paint event of a widget.  */
+class PaintWatcher : public QObject
+{
+public:
+    explicit PaintWatcher(QWidget *widget)
+    {
+        widget->installEventFilter(this);
+    }
+
+    qint64 lastPaint = -1;
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override
+    {
+        Q_UNUSED(watched);
+        if (event->type() == QEvent::Paint) {
+            lastPaint = testClock.nsecsElapsed();
+        }
+        return false;
+    }
+};
+
+static bool notifyReadable()
+{
+    struct pollfd pfd = {notifyFd, POLLIN, 0};
+
+    return poll(&pfd, 1, 0) > 0;
+}
+
+/* Send KEY to EDIT and return the milliseconds until the next paint
+ * of EDIT, or -1 if it is not painted within a few seconds.  */
+static double typeKey(PinLineEdit *edit, const PaintWatcher &watcher, char key)
+{
+    const qint64 start = testClock.nsecsElapsed();
+
+    QTest::keyClick(edit, key);
+    if (!QTest::qWaitFor([&]() { return watcher.lastPaint >= start; }, 5000)) {
+        return -1;
+    }
+    return (watcher.lastPaint - start) / 1e6;
+}
+
+/* Type into DIALOG while a QUALITY inquiry is pending.  */
+static void runDialog(PinEntryDialog &dialog)
+{
+    dialog.show();
+    if (!QTest::qWaitForWindowExposed(&dialog)) {
+        fail("the dialog was not exposed");
+        return;
+    }
+
+    PinLineEdit *const edit = dialog.findChild<PinLineEdit *>();
+    QProgressBar *const bar = dialog.findChild<QProgressBar *>();
+    if (!edit || !bar) {
+        fail("the dialog has no passphrase field or no quality bar");
+        return;
+    }
+    PaintWatcher watcher{edit};
+
+    /* The first key starts the QUALITY inquiry.  */
+    if (typeKey(edit, watcher, 'c') < 0) {
+        fail("the passphrase field was not painted");
+        return;
+    }
+    if (!QTest::qWaitFor(notifyReadable, 5000)) {
+        fail("no INQUIRE QUALITY");
+        return;
+    }
+    QElapsedTimer pending;
+    pending.start();
+
+    double maxLatency = 0;
+    for (const char *p = PendingKeys; *p; p++) {
+        const double latency = typeKey(edit, watcher, *p);
+        if (latency < 0) {
+            fail("the passphrase field was not repainted");
+            return;
+        }
+        maxLatency = qMax(maxLatency, latency);
+    }
+    printf("%d keys while QUALITY is pending: max %.1f ms to repaint"
+           " (budget %d ms)\n",
+           int(sizeof PendingKeys - 1), maxLatency, keyBudget);
+    if (maxLatency > keyBudget) {
+        fail("typing waits for the QUALITY inquiry");
+    } else if (pending.elapsed() >= qualityDelay) {
+        fail("the inquiry was answered before all keys were typed;"
+             " increase T_QUALITY_DELAY");
+    }
+
+    /* The passphrase changed while the inquiry was pending; the
+       quality is inquired once more before it is shown.  */
+    if (!QTest::qWaitFor([bar]() {
+                return bar->isEnabled() && bar->value() == AgentQuality;
+            }, 3 * qualityDelay + 5000)) {
+        fail("the quality was not shown");
+    }
+}
+
+static int test_cmd_handler(pinentry_t pe)
+{
+    if (!pe->pin) {
+        return 0;
+    }
+    handlerRan = true;
+
+    PinEntryDialog dialog{pe, nullptr, 0, true};
+    dialog.setQualityBar(QString::fromUtf8(pe->quality_bar));
+    runDialog(dialog);
+    /* This also waits for the answer to a pending inquiry.  */
+    dialog.reject();
+    pe->canceled = 1;
+    return -1;
+}
+
+pinentry_cmd_handler_t pinentry_cmd_handler = test_cmd_handler;
+
+int main(int argc, char *argv[])
+{
+    int sv[2];
+    int notify[2];
+    int status;
+
+    qualityDelay = env_int("T_QUALITY_DELAY", 2000);
+    keyBudget = env_int("T_KEY_BUDGET", 200);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) || pipe(notify)) {
+        fprintf(stderr, PGM ": can't create the channels: %s\n",
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    /* Fork before Qt starts any threads.  */
+    const pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, PGM ": fork failed: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (!pid) {
+        close(sv[1]);
+        close(notify[0]);
+        _exit(run_agent(sv[0], notify[1], qualityDelay));
+    }
+    close(sv[0]);
+    close(notify[1]);
+    notifyFd = notify[0];
+
+    pinentry_init(PGM);
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app{argc, argv};
+    testClock.start();
+
+    if (pinentry_loop2(sv[1], sv[1])) {
+        fail("the Assuan loop failed");
+    }
+    if (waitpid(pid, &status, 0) < 0
+        || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fail("the agent did not exit cleanly");
+    }
+    if (!handlerRan) {
+        fail("no passphrase was requested");
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
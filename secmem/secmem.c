@@ -109,6 +109,7 @@ static unsigned max_alloced;
 static unsigned cur_alloced;
 static unsigned max_blocks;
 static unsigned cur_blocks;
+static unsigned long total_blocks;
 static int disable_secmem;
 static int show_warning;
 static int no_warning;
@@ -333,6 +334,7 @@ secmem_malloc( size_t size )
   leave:
     cur_alloced += mb->size;
     cur_blocks++;
+    total_blocks++;
     if( cur_alloced > max_alloced )
 	max_alloced = cur_alloced;
     if( cur_blocks > max_blocks )
@@ -434,6 +436,22 @@ secmem_dump_stats(void)
 }
 
 
+void
+secmem_get_stats( struct secmem_stats *stats )
+{
+    memset( stats, 0, sizeof *stats );
+    if( disable_secmem )
+	return;
+    stats->cur_alloced = cur_alloced;
+    stats->max_alloced = max_alloced;
+    stats->cur_blocks = cur_blocks;
+    stats->max_blocks = max_blocks;
+    stats->total_blocks = total_blocks;
+    stats->poollen = poollen;
+    stats->poolsize = poolsize;
+}
+
+
 size_t
 secmem_get_max_size (void)
 {
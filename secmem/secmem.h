@@ -42,6 +42,13 @@ void *secmem_realloc( void *a, size_t newsize );
 void secmem_free( void *a );
 int  m_is_secure( const void *p );
 void secmem_dump_stats(void);
+struct secmem_stats {
+    size_t cur_alloced, max_alloced;	/* Bytes handed out.  */
+    unsigned cur_blocks, max_blocks;	/* Blocks handed out.  */
+    unsigned long total_blocks;		/* Allocations since start.  */
+    size_t poollen, poolsize;		/* Used and total pool size.  */
+};
+void secmem_get_stats( struct secmem_stats *stats );
 void secmem_set_flags( unsigned flags );
 unsigned secmem_get_flags(void);
 size_t secmem_get_max_size (void);
@@ -0,0 +1,296 @@
+/* bench-assuan.c - Throughput of the pinentry Assuan commands.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program runs pinentry_loop2 of libpinentry with a stub
+   pinentry_cmd_handler in a child process and plays gpg-agent over a
+   socketpair: it sends one command, waits for its OK and only then
+   sends the next.  The command list below is sent ITERATIONS times;
+   every command must succeed.  At the end the commands per second,
+   the secure memory allocations per command and the server side run
+   time of each command as returned by "GETINFO stats" are printed.
+
+   Usage: bench-assuan [ITERATIONS]
+
+   ITERATIONS defaults to 1000, which takes well below a second.  Run
+   by "make check", the program also checks that the command loop
+   answers.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <gpg-error.h>
+
+#include "pinentry.h"
+
+#define PGM "bench-assuan"
+
+/* The commands of one iteration, roughly what gpg-agent sends to
+   unlock a key.  */
+static const char *const commands[] =
+  {
+    "OPTION ttyname=/dev/pts/1",
+    "OPTION lc-ctype=en_US.UTF-8",
+    "SETKEYINFO n/0123456789ABCDEF0123456789ABCDEF01234567",
+    "SETDESC Please enter the passphrase to unlock the OpenPGP secret key:"
+    "%0A%22Alice <alice@example.org>%22%0A3072-bit RSA key,"
+    " ID 0123456789ABCDEF,%0Acreated 2024-01-01.%0A",
+    "SETPROMPT Passphrase:",
+    "SETALL SETTITLE Unlock%0ASETOK _Unlock%0ASETCANCEL _Cancel",
+    "GETPIN",
+    "SETERROR Bad Passphrase (try 2 of 3)",
+    "GETPIN",
+    "CONFIRM",
+    "GETINFO version",
+    "RESET"
+  };
+
+#define DIM(v) (sizeof (v) / sizeof ((v)[0]))
+
+/* A line buffered connection to the server.  */
+struct conn
+{
+  int fd;
+  char buf[4096];
+  size_t len;
+};
+
+
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  va_start (arg_ptr, format);
+  fprintf (stderr, PGM ": ");
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  exit (EXIT_FAILURE);
+}
+
+
+/* Return the current time of the monotonic clock in seconds.  */
+static double
+now_sec (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Return a passphrase for GETPIN and OK for CONFIRM and MESSAGE.  */
+static int
+stub_cmd_handler (pinentry_t pin)
+{
+  static const char passphrase[] = "correct horse+battery%staple";
+
+  if (!pin->pin)
+    return 1;
+  if (!pinentry_setbuffer_copy (pin, passphrase, strlen (passphrase)))
+    return -1;
+  return strlen (passphrase);
+}
+
+pinentry_cmd_handler_t pinentry_cmd_handler = stub_cmd_handler;
+
+
+/* Read the next line from CONN into LINE without the linefeed.  */
+static void
+read_line (struct conn *conn, char *line, size_t linesize)
+{
+  char *p;
+  ssize_t n;
+  size_t len;
+
+  while (!(p = memchr (conn->buf, '\n', conn->len)))
+    {
+      if (conn->len == sizeof conn->buf)
+        die ("response line too long\n");
+      do
+        n = read (conn->fd, conn->buf + conn->len,
+                  sizeof conn->buf - conn->len);
+      while (n < 0 && errno == EINTR);
+      if (n < 0)
+        die ("read failed: %s\n", strerror (errno));
+      if (!n)
+        die ("unexpected EOF from the server\n");
+      conn->len += n;
+    }
+
+  len = p - conn->buf;
+  if (len >= linesize)
+    die ("response line too long\n");
+  memcpy (line, conn->buf, len);
+  line[len] = 0;
+  conn->len -= len + 1;
+  memmove (conn->buf, p + 1, conn->len);
+}
+
+
+static void
+send_line (struct conn *conn, const char *line)
+{
+  size_t len = strlen (line);
+  char buffer[1024];
+
+  if (len + 1 > sizeof buffer)
+    die ("command too long\n");
+  memcpy (buffer, line, len);
+  buffer[len++] = '\n';
+  if (write (conn->fd, buffer, len) != (ssize_t)len)
+    die ("write failed: %s\n", strerror (errno));
+}
+
+
+/* Send COMMAND and wait for its result.  The data lines are appended
+   unescaped to DATA, which has room for DATASIZE bytes, if it is not
+   NULL.  */
+static void
+transact (struct conn *conn, const char *command,
+          char *data, size_t datasize)
+{
+  char line[1024];
+  size_t datalen = 0;
+  const char *s;
+
+  send_line (conn, command);
+  for (;;)
+    {
+      read_line (conn, line, sizeof line);
+      if (!strcmp (line, "OK") || !strncmp (line, "OK ", 3))
+        break;
+      if (!strncmp (line, "ERR ", 4))
+        die ("%s failed: %s\n", command, line + 4);
+      if (!strncmp (line, "INQUIRE ", 8))
+        send_line (conn, "END");
+      else if (!strncmp (line, "D ", 2) && data)
+        for (s = line + 2; *s && datalen + 1 < datasize; s++)
+          {
+            if (*s == '%' && s[1] && s[2])
+              {
+                char hex[3] = { s[1], s[2], 0 };
+
+                data[datalen++] = strtol (hex, NULL, 16);
+                s += 2;
+              }
+            else
+              data[datalen++] = *s;
+          }
+    }
+  if (data)
+    data[datalen] = 0;
+}
+
+
+/* Ask the server for its statistics and store them in BUFFER.
+   Return the number of secure memory allocations so far.  */
+static unsigned long
+get_stats (struct conn *conn, char *buffer, size_t buffersize)
+{
+  const char *s;
+
+  transact (conn, "GETINFO stats", buffer, buffersize);
+  s = strstr (buffer, " allocs=");
+  if (!s)
+    die ("no allocation count in GETINFO stats\n");
+  return strtoul (s + 8, NULL, 10);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct conn conn;
+  char stats[4096];
+  char line[1024];
+  int iterations = 1000;
+  int sv[2];
+  pid_t pid;
+  int status;
+  unsigned long allocs;
+  unsigned long ncommands;
+  double start, elapsed;
+  int i;
+  size_t j;
+
+  if (argc > 1)
+    iterations = atoi (argv[1]);
+  if (iterations < 1)
+    die ("usage: " PGM " [ITERATIONS]\n");
+  signal (SIGPIPE, SIG_IGN);
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, sv))
+    die ("socketpair failed: %s\n", strerror (errno));
+  pid = fork ();
+  if (pid < 0)
+    die ("fork failed: %s\n", strerror (errno));
+  if (!pid)
+    {
+      close (sv[0]);
+      pinentry_init (PGM);
+      _exit (pinentry_loop2 (sv[1], sv[1]) ? EXIT_FAILURE : 0);
+    }
+  close (sv[1]);
+
+  memset (&conn, 0, sizeof conn);
+  conn.fd = sv[0];
+  read_line (&conn, line, sizeof line);
+  if (strncmp (line, "OK", 2))
+    die ("unexpected greeting: %s\n", line);
+
+  allocs = get_stats (&conn, stats, sizeof stats);
+  ncommands = 0;
+  start = now_sec ();
+  for (i = 0; i < iterations; i++)
+    for (j = 0; j < DIM (commands); j++)
+      {
+        transact (&conn, commands[j], NULL, 0);
+        ncommands++;
+      }
+  elapsed = now_sec () - start;
+  allocs = get_stats (&conn, stats, sizeof stats) - allocs;
+
+  transact (&conn, "BYE", NULL, 0);
+  close (sv[0]);
+  if (waitpid (pid, &status, 0) < 0)
+    die ("waitpid failed: %s\n", strerror (errno));
+  if (!WIFEXITED (status) || WEXITSTATUS (status))
+    die ("the server did not exit cleanly\n");
+
+  printf ("%lu commands in %.3f s: %.0f commands/s,"
+          " %.2f secmem allocations/command\n",
+          ncommands, elapsed, elapsed > 0 ? ncommands / elapsed : 0.0,
+          (double)allocs / ncommands);
+  printf ("%s\n", stats);
+  return 0;
+}
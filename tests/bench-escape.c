@@ -0,0 +1,248 @@
+/* bench-escape.c - Time the percent-escaping of pinentry.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This program compares copy_and_escape and do_unescape_inplace of
+   pinentry.c, which are static and therefore taken by including the
+   source, with the byte loops they replaced.  It first checks that
+   both give the same result for random input and then prints the
+   nanoseconds per call of each for a few typical strings.
+
+   Usage: bench-escape [ITERATIONS]
+
+   ITERATIONS defaults to 100000.  */
+
+#include "pinentry.c"
+
+#include <time.h>
+
+#define PGM "bench-escape"
+
+
+static int
+stub_cmd_handler (pinentry_t pin)
+{
+  (void)pin;
+  return -1;
+}
+
+pinentry_cmd_handler_t pinentry_cmd_handler = stub_cmd_handler;
+
+
+/* copy_and_escape as it was, with one snprintf per escape.  */
+static char *
+old_copy_and_escape (char *buffer, const void *text, size_t textlen)
+{
+  size_t i;
+  const unsigned char *s = (unsigned char *)text;
+  char *p = buffer;
+
+  for (i=0; i < textlen; i++)
+    {
+      if (s[i] < ' ' || s[i] == '+')
+        {
+          snprintf (p, 4, "%%%02X", s[i]);
+          p += 3;
+        }
+      else if (s[i] == ' ')
+        *p++ = '+';
+      else
+        *p++ = s[i];
+    }
+  return p;
+}
+
+
+/* do_unescape_inplace as it was, going byte by byte.  */
+static size_t
+old_unescape_inplace (char *s)
+{
+  unsigned char *p, *p0;
+
+  p = p0 = (unsigned char *)s;
+  while (*s)
+    {
+      if (*s == '%' && s[1] && s[2])
+        {
+          s++;
+          *p++ = xtoi_2 (s);
+          s += 2;
+        }
+      else
+        *p++ = *s++;
+    }
+  *p = 0;
+
+  return (p - p0);
+}
+
+
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  va_start (arg_ptr, format);
+  fprintf (stderr, PGM ": ");
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  exit (EXIT_FAILURE);
+}
+
+
+/* Return the current time of the monotonic clock in nanoseconds.  */
+static double
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* Compare the old and new functions on random input.  */
+static void
+check_random (void)
+{
+  static const char alphabet[] = "%%%0123456789abcdefABCDEF+ \n\t\x01\xff";
+  unsigned char text[300];
+  char old[3 * sizeof text + 1], new[3 * sizeof text + 1];
+  char *p;
+  size_t len, oldlen, newlen, j;
+  int i;
+
+  srand (42);
+  for (i = 0; i < 10000; i++)
+    {
+      len = rand () % sizeof text;
+      for (j = 0; j < len; j++)
+        text[j] = (rand () & 1)? rand () % 256
+                  : alphabet[rand () % (sizeof alphabet - 1)];
+
+      p = old_copy_and_escape (old, text, len);
+      *p = 0;
+      copy_and_escape (new, text, len);
+      if (strcmp (old, new))
+        die ("copy_and_escape differs for input %d\n", i);
+
+      /* Unescape the text as a string.  */
+      for (j = 0; j < len; j++)
+        if (!text[j])
+          text[j] = 'x';
+      memcpy (old, text, len);
+      old[len] = 0;
+      memcpy (new, text, len);
+      new[len] = 0;
+      oldlen = old_unescape_inplace (old);
+      newlen = do_unescape_inplace (new);
+      if (oldlen != newlen || memcmp (old, new, oldlen + 1))
+        die ("do_unescape_inplace differs for input %d\n", i);
+    }
+}
+
+
+/* Print the time per call of the old and new escaping of TEXT.  */
+static void
+time_escape (const char *what, const char *text, int iterations)
+{
+  char buffer[3 * 1000 + 1];
+  size_t len = strlen (text);
+  volatile size_t sink = 0;
+  double start, old, new;
+  int i;
+
+  start = now_ns ();
+  for (i = 0; i < iterations; i++)
+    sink += old_copy_and_escape (buffer, text, len) - buffer;
+  old = (now_ns () - start) / iterations;
+
+  start = now_ns ();
+  for (i = 0; i < iterations; i++)
+    sink += copy_and_escape (buffer, text, len) - buffer;
+  new = (now_ns () - start) / iterations;
+
+  (void)sink;
+  printf ("escape %-30s %8.0f ns -> %6.0f ns\n", what, old, new);
+}
+
+
+/* Print the time per call of the old and new unescaping of TEXT.  */
+static void
+time_unescape (const char *what, const char *text, int iterations)
+{
+  char buffer[1001];
+  size_t len = strlen (text);
+  volatile size_t sink = 0;
+  double start, old, new;
+  int i;
+
+  /* Copying the input is part of both timings.  */
+  start = now_ns ();
+  for (i = 0; i < iterations; i++)
+    {
+      memcpy (buffer, text, len + 1);
+      sink += old_unescape_inplace (buffer);
+    }
+  old = (now_ns () - start) / iterations;
+
+  start = now_ns ();
+  for (i = 0; i < iterations; i++)
+    {
+      memcpy (buffer, text, len + 1);
+      sink += do_unescape_inplace (buffer);
+    }
+  new = (now_ns () - start) / iterations;
+
+  (void)sink;
+  printf ("unescape %-28s %8.0f ns -> %6.0f ns\n", what, old, new);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  static const char desc[] =
+    "Please enter the passphrase to unlock the OpenPGP secret key:%0A"
+    "%22Alice <alice@example.org>%22%0A3072-bit RSA key, "
+    "ID 0123456789ABCDEF,%0Acreated 2024-01-01.%0A";
+  char line[1001];
+  int iterations = 100000;
+  size_t len;
+
+  if (argc > 1)
+    iterations = atoi (argv[1]);
+  if (iterations < 1)
+    die ("usage: " PGM " [ITERATIONS]\n");
+
+  check_random ();
+
+  /* A SETDESC line of the maximum Assuan line length.  */
+  for (len = 0; len + sizeof desc - 1 < sizeof line; len += sizeof desc - 1)
+    memcpy (line + len, desc, sizeof desc - 1);
+  line[len] = 0;
+
+  time_escape ("\"a+b+c+d+e+1+2+3+x+y+z+!\"", "a+b+c+d+e+1+2+3+x+y+z+!",
+               iterations);
+  time_escape ("a plain passphrase", "correct horse battery staple 2024!",
+               iterations);
+  time_unescape ("a short description", desc, iterations);
+  time_unescape ("a 1000 byte SETDESC line", line, iterations);
+  return 0;
+}
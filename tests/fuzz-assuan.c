@@ -0,0 +1,234 @@
+/* fuzz-assuan.c - Fuzz the pinentry Assuan commands.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* Each input is a transcript of what a client sends to pinentry:
+   command lines, including the D and END lines which answer an
+   inquiry.  A forked writer feeds the transcript into a pipe and
+   pinentry_loop2 of libpinentry runs over it in this process, with a
+   stub pinentry_cmd_handler and the responses going to /dev/null.
+   This reaches the command table, option_handler, SETALL and the
+   unescaping of the arguments.
+
+   With HAVE_LIBFUZZER defined, which configure does for
+   --enable-fuzzing if the compiler supports -fsanitize=fuzzer, this
+   file is a libFuzzer target.  Otherwise it has a main function which
+   runs each file given on the command line, or the standard input,
+   through the same code; use that for AFL and to replay a crash.
+
+   The password cache is replaced by one in memory, so that no input
+   reaches the keyring of the user running the fuzzer.  Like a long
+   running pinentry, the values set by one input stay in effect for
+   the next one.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <gpg-error.h>
+
+#include "pinentry.h"
+#include "password-cache.h"
+#include "secmem.h"
+#include "secmem-util.h"
+
+#define PGM "fuzz-assuan"
+
+/* The size of the buffer for one input of the standalone driver.  */
+#define MAX_INPUT 65536
+
+/* Appended to every input so that the loop ends without waiting for
+   more.  */
+static const char trailer[] = "\nBYE\n";
+
+static int devnull = -1;
+
+/* The entry of the password cache.  */
+static char cached_keygrip[100];
+static char cached_password[100];
+
+
+/* Return a passphrase for GETPIN and OK for CONFIRM and MESSAGE.  */
+static int
+stub_cmd_handler (pinentry_t pin)
+{
+  static const char passphrase[] = "fuzz+pass%phrase";
+
+  if (!pin->pin)
+    return 1;
+  if (!pinentry_setbuffer_copy (pin, passphrase, strlen (passphrase)))
+    return -1;
+  return strlen (passphrase);
+}
+
+pinentry_cmd_handler_t pinentry_cmd_handler = stub_cmd_handler;
+
+
+/* These replace the functions of password-cache.c, which talk to the
+   Secret Service, by a cache of one entry.  */
+void
+password_cache_save (const char *keygrip, const char *password)
+{
+  snprintf (cached_keygrip, sizeof cached_keygrip, "%s", keygrip);
+  snprintf (cached_password, sizeof cached_password, "%s", password);
+}
+
+
+char *
+password_cache_lookup (const char *keygrip, int *fatal_error)
+{
+  char *password;
+
+  (void)fatal_error;
+
+  if (!*keygrip || strcmp (keygrip, cached_keygrip))
+    return NULL;
+  password = secmem_malloc (strlen (cached_password) + 1);
+  if (password)
+    strcpy (password, cached_password);
+  return password;
+}
+
+
+int
+password_cache_clear (const char *keygrip)
+{
+  if (!*cached_keygrip || strcmp (keygrip, cached_keygrip))
+    return 0;
+  *cached_keygrip = 0;
+  wipememory (cached_password, sizeof cached_password);
+  return 1;
+}
+
+
+/* OPTION debug-wait sleeps, and it may as well come percent-escaped
+   in a SETALL line.  Don't let it stall the fuzzer.  */
+unsigned int
+sleep (unsigned int seconds)
+{
+  (void)seconds;
+  return 0;
+}
+
+
+/* Write SIZE bytes of DATA and the trailer to FD.  */
+static void
+write_transcript (int fd, const uint8_t *data, size_t size)
+{
+  ssize_t n;
+
+  while (size)
+    {
+      n = write (fd, data, size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return;  /* The loop stopped reading early.  */
+      data += n;
+      size -= n;
+    }
+  if (write (fd, trailer, strlen (trailer)) < 0)
+    return;
+}
+
+
+int LLVMFuzzerTestOneInput (const uint8_t *data, size_t size);
+
+int
+LLVMFuzzerTestOneInput (const uint8_t *data, size_t size)
+{
+  int fds[2];
+  pid_t pid;
+  int status;
+
+  if (devnull == -1)
+    {
+      pinentry_init (PGM);
+      devnull = open ("/dev/null", O_WRONLY);
+      if (devnull == -1)
+        abort ();
+      signal (SIGPIPE, SIG_IGN);
+    }
+
+  /* A pipe may hold as little as one page, so the transcript is
+     written by a child while the loop reads it.  */
+  if (pipe (fds))
+    abort ();
+  pid = fork ();
+  if (pid < 0)
+    abort ();
+  if (!pid)
+    {
+      close (fds[0]);
+      write_transcript (fds[1], data, size);
+      _exit (0);
+    }
+  close (fds[1]);
+
+  pinentry_loop2 (fds[0], devnull);
+  close (fds[0]);
+  while (waitpid (pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  return 0;
+}
+
+
+#ifndef HAVE_LIBFUZZER
+static void
+run_file (const char *fname)
+{
+  FILE *fp = fname ? fopen (fname, "rb") : stdin;
+  static uint8_t buffer[MAX_INPUT];
+  size_t n;
+
+  if (!fp)
+    {
+      fprintf (stderr, PGM ": can't open '%s': %s\n",
+               fname, strerror (errno));
+      exit (EXIT_FAILURE);
+    }
+  n = fread (buffer, 1, sizeof buffer, fp);
+  if (fname)
+    fclose (fp);
+  LLVMFuzzerTestOneInput (buffer, n);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  if (argc < 2)
+    run_file (NULL);
+  for (i = 1; i < argc; i++)
+    run_file (argv[i]);
+  return 0;
+}
+#endif /*!HAVE_LIBFUZZER*/
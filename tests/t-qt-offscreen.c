@@ -0,0 +1,459 @@
+/* t-qt-offscreen.c - Drive pinentry-qt on Qt's offscreen platform.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of PINENTRY.
+ *
+ * PINENTRY is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PINENTRY is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-2.0+
+ */
+
+/* This test plays the part of gpg-agent for pinentry-qt.  It starts
+   the program named by the environment variable PINENTRY_QT with
+   QT_QPA_PLATFORM=offscreen, sends a GETPIN request, answers the
+   inquiries of pinentry-qt and checks that the passphrase dialog is
+   painted within a latency budget.  The time is taken when the
+   "dialog-first-paint" event of the gpg.pinentry.perf log arrives on
+   stderr.  The offscreen platform has no input devices, thus every
+   GETPIN returns at its timeout.
+
+   These environment variables are used:
+
+     PINENTRY_QT       The program to test.
+     T_SHOWN_BUDGET    Maximum milliseconds from sending GETPIN to the
+                       first paint of the dialog (default 3000).
+     T_INQUIRE_DELAY   Milliseconds to wait before answering an
+                       inquiry (default 0).
+     T_RUNS            Number of pinentry-qt processes to start one
+                       after the other (default 1).  With more than
+                       one run, the minimum, median and maximum time
+                       to show the dialog are printed and the median
+                       is checked against the budget.
+
+   The exit status is 77 (skipped) if PINENTRY_QT is not set or
+   pinentry-qt does not get to show the dialog on the offscreen
+   platform, e.g. because the platform plugin is missing.  */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PGM "t-qt-offscreen"
+
+/* Exit status of a skipped test for the Automake test driver.  */
+#define EXIT_SKIP 77
+
+/* Milliseconds to wait for any response of pinentry-qt.  */
+#define RESPONSE_TIMEOUT 30000
+
+/* The error code of GPG_ERR_TIMEOUT.  */
+#define ERR_CODE_TIMEOUT 62
+
+/* A line buffered input stream from pinentry-qt.  */
+struct stream
+{
+  int fd;
+  char buf[2048];
+  size_t len;
+  int eof;
+};
+
+struct peer
+{
+  pid_t pid;
+  int to_fd;
+  struct stream out;
+  struct stream err;
+  int inquire_delay;
+  /* The time the first dialog-first-paint event was seen or -1.  */
+  double first_paint;
+};
+
+
+static void
+die (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  va_start (arg_ptr, format);
+  fprintf (stderr, PGM ": ");
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  exit (EXIT_FAILURE);
+}
+
+
+static void
+skip (const char *format, ...)
+{
+  va_list arg_ptr;
+
+  va_start (arg_ptr, format);
+  fprintf (stderr, PGM ": skipped: ");
+  vfprintf (stderr, format, arg_ptr);
+  va_end (arg_ptr);
+  exit (EXIT_SKIP);
+}
+
+
+/* Return the current time of the monotonic clock in milliseconds.  */
+static double
+now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+static int
+env_int (const char *name, int dflt)
+{
+  const char *s = getenv (name);
+
+  return s && *s ? atoi (s) : dflt;
+}
+
+
+/* Start PROGRAM as the peer.  */
+static void
+start_peer (struct peer *peer, const char *program)
+{
+  int to_child[2], from_child[2], err_child[2];
+
+  if (pipe (to_child) || pipe (from_child) || pipe (err_child))
+    die ("pipe failed: %s\n", strerror (errno));
+
+  peer->pid = fork ();
+  if (peer->pid == (pid_t)-1)
+    die ("fork failed: %s\n", strerror (errno));
+  if (!peer->pid)
+    {
+      dup2 (to_child[0], 0);
+      dup2 (from_child[1], 1);
+      dup2 (err_child[1], 2);
+      close (to_child[0]);
+      close (to_child[1]);
+      close (from_child[0]);
+      close (from_child[1]);
+      close (err_child[0]);
+      close (err_child[1]);
+      setenv ("QT_QPA_PLATFORM", "offscreen", 1);
+      setenv ("QT_LOGGING_RULES", "gpg.pinentry.perf.debug=true", 1);
+      /* Do not fall back to curses for lack of a display.  */
+      setenv ("XDG_SESSION_TYPE", "x11", 1);
+      execl (program, program, (char *)NULL);
+      fprintf (stderr, PGM ": can't exec '%s': %s\n",
+               program, strerror (errno));
+      _exit (127);
+    }
+
+  close (to_child[0]);
+  close (from_child[1]);
+  close (err_child[1]);
+  peer->to_fd = to_child[1];
+  memset (&peer->out, 0, sizeof peer->out);
+  peer->out.fd = from_child[0];
+  memset (&peer->err, 0, sizeof peer->err);
+  peer->err.fd = err_child[0];
+  peer->first_paint = -1;
+}
+
+
+/* Return the next complete line of STREAM (without the LF) at LINE,
+   or 0 if there is none yet.  The line is valid until the next
+   call.  */
+static int
+take_line (struct stream *stream, char *line, size_t linesize)
+{
+  char *lf = memchr (stream->buf, '\n', stream->len);
+  size_t n;
+
+  if (!lf && stream->len == sizeof stream->buf)
+    lf = stream->buf + stream->len - 1;  /* Overlong; split it.  */
+  if (!lf)
+    return 0;
+
+  n = lf - stream->buf;
+  if (n >= linesize)
+    n = linesize - 1;
+  memcpy (line, stream->buf, n);
+  line[n] = 0;
+  n = lf - stream->buf + 1;
+  memmove (stream->buf, stream->buf + n, stream->len - n);
+  stream->len -= n;
+  return 1;
+}
+
+
+static void
+fill_stream (struct stream *stream)
+{
+  ssize_t n;
+
+  do
+    n = read (stream->fd, stream->buf + stream->len,
+              sizeof stream->buf - stream->len);
+  while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    stream->eof = 1;
+  else
+    stream->len += n;
+}
+
+
+/* Note the perf events of interest in the stderr LINE.  */
+static void
+check_log_line (struct peer *peer, const char *line)
+{
+  if (peer->first_paint < 0 && strstr (line, "event=dialog-first-paint"))
+    peer->first_paint = now_ms ();
+  if (getenv ("T_VERBOSE"))
+    fprintf (stderr, PGM ": log: %s\n", line);
+}
+
+
+/* Read the next line from the stdout of PEER into LINE while
+   processing its stderr.  Returns -1 on EOF or timeout.  */
+static int
+read_line (struct peer *peer, char *line, size_t linesize)
+{
+  double deadline = now_ms () + RESPONSE_TIMEOUT;
+  struct pollfd pfd[2];
+  int nfds, n;
+
+  for (;;)
+    {
+      while (take_line (&peer->err, line, linesize))
+        check_log_line (peer, line);
+      if (take_line (&peer->out, line, linesize))
+        return 0;
+      if (peer->out.eof)
+        return -1;
+
+      nfds = 0;
+      pfd[nfds].fd = peer->out.fd;
+      pfd[nfds++].events = POLLIN;
+      if (!peer->err.eof)
+        {
+          pfd[nfds].fd = peer->err.fd;
+          pfd[nfds++].events = POLLIN;
+        }
+      n = poll (pfd, nfds, (int)(deadline - now_ms ()));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return -1;
+      if (pfd[0].revents)
+        fill_stream (&peer->out);
+      if (nfds > 1 && pfd[1].revents)
+        fill_stream (&peer->err);
+    }
+}
+
+
+static void
+send_line (struct peer *peer, const char *line)
+{
+  size_t len = strlen (line);
+
+  if (write (peer->to_fd, line, len) != (ssize_t)len
+      || write (peer->to_fd, "\n", 1) != 1)
+    die ("error writing to pinentry: %s\n", strerror (errno));
+}
+
+
+/* Answer the inquiry KEYWORD like gpg-agent would.  */
+static void
+answer_inquiry (struct peer *peer, const char *keyword)
+{
+  if (peer->inquire_delay > 0)
+    poll (NULL, 0, peer->inquire_delay);
+
+  if (!strncmp (keyword, "QUALITY", 7))
+    send_line (peer, "D 50");
+  else if (!strncmp (keyword, "GENPIN", 6))
+    send_line (peer, "D generated passphrase");
+  else if (strncmp (keyword, "CHECKPIN", 8))
+    {
+      send_line (peer, "CAN");
+      return;
+    }
+  send_line (peer, "END");
+}
+
+
+/* Send COMMAND and process the responses until the final OK or ERR,
+   which is stored at RESULT.  Returns -1 if pinentry-qt went away or
+   did not respond in time.  */
+static int
+transact (struct peer *peer, const char *command,
+          char *result, size_t resultsize)
+{
+  char line[1024];
+
+  if (command)
+    send_line (peer, command);
+  for (;;)
+    {
+      if (read_line (peer, line, sizeof line))
+        return -1;
+      if (!strncmp (line, "INQUIRE ", 8))
+        answer_inquiry (peer, line + 8);
+      else if (!strncmp (line, "OK", 2) || !strncmp (line, "ERR", 3))
+        {
+          snprintf (result, resultsize, "%s", line);
+          return 0;
+        }
+      /* Ignore S, D and comment lines.  */
+    }
+}
+
+
+static void
+expect_ok (struct peer *peer, const char *command)
+{
+  char result[1024];
+
+  if (transact (peer, command, result, sizeof result))
+    die ("no response to '%s'\n", command);
+  if (strncmp (result, "OK", 2))
+    die ("'%s' failed: %s\n", command, result);
+}
+
+
+/* Return the error code of the ERR line RESULT or 0.  */
+static unsigned int
+err_code (const char *result)
+{
+  if (strncmp (result, "ERR ", 4))
+    return 0;
+  return strtoul (result + 4, NULL, 10) & 0xffff;
+}
+
+
+/* Start pinentry-qt, run a GETPIN and a retry, and return the time
+   in milliseconds from sending the first GETPIN to the first paint of
+   the dialog.  */
+static double
+run_once (const char *program, int inquire_delay)
+{
+  struct peer peer;
+  char result[1024];
+  double start;
+  int status;
+
+  start_peer (&peer, program);
+  peer.inquire_delay = inquire_delay;
+
+  if (transact (&peer, NULL, result, sizeof result)
+      || strncmp (result, "OK", 2))
+    skip ("%s does not start\n", program);
+
+  expect_ok (&peer, "SETDESC Please enter the passphrase of the test key");
+  expect_ok (&peer, "SETPROMPT Passphrase:");
+  expect_ok (&peer, "SETQUALITYBAR Quality:");
+  expect_ok (&peer, "SETTIMEOUT 1");
+
+  /* The first GETPIN creates the QApplication and the dialog.  */
+  start = now_ms ();
+  if (transact (&peer, "GETPIN", result, sizeof result))
+    skip ("%s does not run on the offscreen platform\n", program);
+  if (peer.first_paint < 0)
+    skip ("the dialog was not painted (%s)\n", result);
+  if (err_code (result) != ERR_CODE_TIMEOUT)
+    die ("GETPIN: expected a timeout, got: %s\n", result);
+
+  /* A retry reuses the dialog.  */
+  expect_ok (&peer, "SETERROR Bad Passphrase (try 2 of 3)");
+  if (transact (&peer, "GETPIN", result, sizeof result))
+    die ("no response to the second GETPIN\n");
+  if (err_code (result) != ERR_CODE_TIMEOUT)
+    die ("second GETPIN: expected a timeout, got: %s\n", result);
+
+  expect_ok (&peer, "BYE");
+  close (peer.to_fd);
+  close (peer.out.fd);
+  close (peer.err.fd);
+  if (waitpid (peer.pid, &status, 0) == (pid_t)-1)
+    die ("waitpid failed: %s\n", strerror (errno));
+  if (!WIFEXITED (status) || WEXITSTATUS (status))
+    die ("%s did not exit cleanly (status %d)\n", program, status);
+
+  return peer.first_paint - start;
+}
+
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *program = getenv ("PINENTRY_QT");
+  int budget = env_int ("T_SHOWN_BUDGET", 3000);
+  int inquire_delay = env_int ("T_INQUIRE_DELAY", 0);
+  int runs = env_int ("T_RUNS", 1);
+  double *shown, median;
+  int i;
+
+  (void)argc;
+  (void)argv;
+
+  if (!program || !*program)
+    skip ("PINENTRY_QT is not set\n");
+  if (runs < 1)
+    runs = 1;
+  signal (SIGPIPE, SIG_IGN);
+
+  shown = calloc (runs, sizeof *shown);
+  if (!shown)
+    die ("out of core\n");
+  for (i = 0; i < runs; i++)
+    shown[i] = run_once (program, inquire_delay);
+
+  qsort (shown, runs, sizeof *shown, compare_doubles);
+  median = (shown[(runs - 1) / 2] + shown[runs / 2]) / 2;
+  if (runs == 1)
+    printf ("GETPIN to first paint: %.1f ms (budget %d ms)\n",
+            median, budget);
+  else
+    printf ("GETPIN to first paint over %d runs: min %.1f ms,"
+            " median %.1f ms, max %.1f ms (budget %d ms)\n",
+            runs, shown[0], median, shown[runs - 1], budget);
+  free (shown);
+
+  if (median > budget)
+    die ("the dialog took %.1f ms to show; the budget is %d ms\n",
+         median, budget);
+  return 0;
+}
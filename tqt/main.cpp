@@ -143,19 +143,9 @@ qt_cmd_handler (pinentry_t pe)
       if (!pin)
 	return -1;
 
-      int len = strlen (pin);
-      if (len >= 0)
-	{
-	  pinentry_setbufferlen (pe, len + 1);
-	  if (pe->pin)
-	    {
-	      strcpy (pe->pin, pin);
-	      ::secmem_free (pin);
-	      return len;
-	    }
-	}
-      ::secmem_free (pin);
-      return -1;
+      /* PIN is allocated in secure memory; hand it over.  */
+      pinentry_setbuffer_use (pe, pin, 0);
+      return pe->pin_datalen;
     }
   else
     {
@@ -328,8 +328,12 @@ confirm (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
   return ret;
 }
 
+/* Read a passphrase into a new buffer from the secure memory and
+   return it.  Its size is stored at R_SIZE and the length of the
+   passphrase at R_LENGTH.  */
 static char *
-read_password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
+read_password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo,
+               int *r_size, int *r_length)
 {
   int done = 0;
   int len = 128;
@@ -390,6 +394,8 @@ read_password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
       return NULL;
     }
 
+  *r_size = len;
+  *r_length = count;
   return buffer;
 }
 
@@ -415,6 +421,7 @@ password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
   while (! done)
     {
       char *passphrase;
+      int size, length;
 
       char *prompt = pinentry->prompt;
       if (! prompt || !*prompt)
@@ -427,7 +434,7 @@ password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
 		|| prompt[strlen(prompt) - 1] == '?') ? "" : ":");
       fflush (ttyfo);
 
-      passphrase = read_password (pinentry, ttyfi, ttyfo);
+      passphrase = read_password (pinentry, ttyfi, ttyfo, &size, &length);
       fputc ('\n', ttyfo);
       if (! passphrase)
 	{
@@ -440,6 +447,7 @@ password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
       else
 	{
 	  char *passphrase2;
+	  int size2, length2;
 
 	  prompt = pinentry->repeat_passphrase;
 	  fprintf (ttyfo, "%s%s ",
@@ -449,7 +457,8 @@ password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
 		    || prompt[strlen(prompt) - 1] == '?') ? "" : ":");
 	  fflush (ttyfo);
 
-	  passphrase2 = read_password (pinentry, ttyfi, ttyfo);
+	  passphrase2 = read_password (pinentry, ttyfi, ttyfo,
+	                               &size2, &length2);
 	  fputc ('\n', ttyfo);
 	  if (! passphrase2)
 	    {
@@ -457,7 +466,8 @@ password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
 	      break;
 	    }
 
-	  if (strcmp (passphrase, passphrase2) == 0)
+	  if (length == length2
+	      && memcmp (passphrase, passphrase2, length) == 0)
 	    {
 	      pinentry->repeat_okay = 1;
 	      done = 1;
@@ -471,7 +481,11 @@ password (pinentry_t pinentry, FILE *ttyfi, FILE *ttyfo)
 	}
 
       if (done == 1)
-	pinentry_setbuffer_use (pinentry, passphrase, 0);
+	{
+	  /* Hand the buffer over without copying it.  */
+	  pinentry_setbuffer_use (pinentry, passphrase, size);
+	  pinentry->pin_datalen = length;
+	}
       else
 	secmem_free (passphrase);
     }
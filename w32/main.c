@@ -419,12 +419,10 @@ ok_button_clicked (HWND dlg, pinentry_t pe)
   if (s_utf8)
     {
       passphrase_ok = 1;
-      pinentry_setbufferlen (pe, strlen (s_utf8) + 1);
-      if (pe->pin)
-        strcpy (pe->pin, s_utf8);
+      pinentry_setbuffer_copy (pe, s_utf8, strlen (s_utf8));
       secmem_free (s_utf8);
       pe->locale_err = 0;
-      pe->result = pe->pin? strlen (pe->pin) : 0;
+      pe->result = pe->pin? pe->pin_datalen : 0;
     }
 }
 